@@ -0,0 +1,69 @@
+#!/bin/bash
+# Build a BENCH=1 kernel, run it, and collect its BENCH lines in
+# bench_output.txt. If .test/bench_baseline.txt exists, compare each
+# metric against it and fail when one moves the wrong way by more
+# than THRESHOLD percent.
+#
+#   .test/bench.sh                  run and compare
+#   .test/bench.sh --save           run and make this the new baseline
+
+THRESHOLD=${THRESHOLD:-10}
+TIMEOUT=${TIMEOUT:-120}
+baseline=.test/bench_baseline.txt
+
+make clean > /dev/null
+timeout $TIMEOUT make qemu BENCH=1 < /dev/null 2>&1 | tr -d '\r' > .test/bench.out
+grep '^BENCH ' .test/bench.out > bench_output.txt
+
+if ! grep -q 'Benchmarks done' .test/bench.out; then
+  echo "benchmark kernel did not finish; see .test/bench.out"
+  exit 1
+fi
+
+cat bench_output.txt
+
+if [ "$1" == "--save" ]; then
+  cp bench_output.txt $baseline
+  exit 0
+fi
+[ -f $baseline ] || exit 0
+
+# a line's key is every field that is not a metric; throughput
+# metrics should not drop, cost metrics (cycles, times and _count
+# event counts) should not rise.
+awk -v threshold=$THRESHOLD '
+function parse(line, key, m,   i, n, f, kv) {
+  n = split(line, f, " ")
+  key[0] = f[2]
+  for(i = 3; i <= n; i++) {
+    split(f[i], kv, "=")
+    if(kv[1] ~ /cycles|_per_sec$|_per_kb$|_(ns|us)$|_count$/)
+      m[kv[1]] = kv[2]
+    else
+      key[0] = key[0] " " f[i]
+  }
+  return key[0]
+}
+NR == FNR {
+  k = parse($0, key, m)
+  for(name in m) base[k, name] = m[name]
+  delete m
+  next
+}
+{
+  k = parse($0, key, m)
+  for(name in m) {
+    if(!((k, name) in base) || base[k, name] == 0)
+      continue
+    d = (m[name] - base[k, name]) * 100 / base[k, name]
+    if(name ~ /_per_sec$/)
+      d = -d
+    if(d > threshold) {
+      printf("REGRESSION %s %s: %s -> %s\n", k, name, base[k, name], m[name])
+      bad = 1
+    }
+  }
+  delete m
+}
+END { exit bad }
+' $baseline bench_output.txt
@@ -1,6 +1,10 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include <stdarg.h>
+
+#include "types.h"
+
 /*
  * Initialize the UART driver.
  * Parameters: None
@@ -8,21 +12,120 @@
  */
 void uartinit(void);
 
+/*
+ * Set the UART line speed (8 data bits, no parity).
+ * Parameters:
+ *  - baud: The speed in bits per second, at most 115200.
+ * Returns: None
+ */
+void uartsetbaud(int baud);
+
+/*
+ * Set how many bytes uartstart loads into the transmit FIFO each
+ * time it finds the FIFO empty: 1 for one interrupt per byte, up to
+ * 16 (the default) for FIFO bursts.
+ * Parameters:
+ *  - n: Bytes per burst; clamped to 1..16.
+ * Returns: None
+ */
+void uartsetburst(int n);
+
+// UART driver counters, since boot.
+struct uartstats {
+  uint64 intr;            // calls to uartintr
+  uint64 tx;              // bytes written to THR
+  uint64 rx;              // bytes read from RHR
+  uint64 cycles;          // cycles spent in uartintr and its tasklet, uartstart, uartflush
+  uint64 overrun;         // times LSR reported lost input
+  uint64 rxdrop;          // input bytes dropped for want of buffer space
+  uint64 urgent_dropped;  // urgent-lane bytes dropped because the lane was full
+};
+
+/*
+ * Copy out the UART driver counters.
+ * Parameters:
+ *  - st: Where to store them.
+ * Returns: None
+ */
+void uartgetstats(struct uartstats *st);
+
 /*
  * Handle a UART interrupt, raised because input has
  * arrived, or the UART is ready for more output, or
- * both. Called from trap.c.
+ * both. Called from trap.c. Input is only collected here;
+ * echo, line editing and delivery to PORT_CONSOLEIN run
+ * afterwards as a tasklet.
  * Parameters: None
  * Returns: None
  */
 void uartintr(void);
 
 /*
- * If the UART is idle, and a chracter is waiting in the
- * console out port, send it. 
+ * If the UART is idle, and characters are waiting in the urgent
+ * lane or the console out port, send up to a FIFO's worth of them.
  */
 void uartstart(void);
 
+/*
+ * Output has been queued on PORT_CONSOLEOUT. Start sending it at
+ * once, or, in coalescing mode, once a FIFO's worth is waiting or a
+ * short deadline passes. printf calls this after every message.
+ * Parameters: None
+ * Returns: None
+ */
+void uartkick(void);
+
+/*
+ * Turn output coalescing on or off. Interactive echo from uartintr
+ * and the urgent lane are never delayed.
+ * Parameters:
+ *  - on: Non-zero to coalesce printf output, zero to send at once.
+ * Returns: None
+ */
+void uartcoalesce(int on);
+
+/*
+ * Turn the echo of console input on or off. Input still reaches
+ * PORT_CONSOLEIN either way.
+ * Parameters:
+ *  - on: Non-zero to echo input to PORT_CONSOLEOUT (the default).
+ * Returns: None
+ */
+void uartecho(int on);
+
+/*
+ * Keep the UART interrupt and the console input tasklet from running
+ * on this hart, without turning off other interrupts. Wrap mainline
+ * code that touches the console ports or the UART's queues in
+ * uartmask/uartunmask rather than intr_off, so timers and the disk
+ * are not held up behind console work. Pairs nest. Masking is local
+ * to the hart: other harts still take UART interrupts and run console
+ * input, and only the UART's and the ports' locks keep them out.
+ * Parameters: None
+ * Returns: None
+ */
+void uartmask(void);
+
+/*
+ * Undo one uartmask. The last one unmasks the UART and runs any
+ * console input that arrived in the meantime.
+ * Parameters: None
+ * Returns: None
+ */
+void uartunmask(void);
+
+/*
+ * Queue bytes on the urgent output lane, which uartstart drains
+ * ahead of PORT_CONSOLEOUT, and start transmitting. Bytes that do
+ * not fit in the lane are dropped rather than waited for.
+ * Parameters:
+ *  - buf: The bytes to send.
+ *  - n: The number of bytes.
+ * Returns:
+ *  - The number of bytes queued.
+ */
+int uarturgent(char *buf, int n);
+
 /*
  * Transmit a character via the UART, waiting for it to transmit completely.
  * Parameters:
@@ -32,7 +135,8 @@ void uartstart(void);
 void uartputc(int c);
 
 /*
- * Transmit all of the characters in the PORT_CONSOLEOUT port.
+ * Transmit all of the characters in the urgent lane and then the
+ * PORT_CONSOLEOUT port.
  * Send them one character at a time using uartputc.
  * Parameters: None
  * Returns: None
@@ -40,7 +144,16 @@ void uartputc(int c);
 void uartflush(void);
 
 /*
- * Print to the console. Only understands %d, %x, %p, %s.
+ * Wait until the UART has sent everything handed to it, down to
+ * the last bit in the shift register (LSR TEMT).
+ * Parameters: None
+ * Returns: None
+ */
+void uartdrain(void);
+
+/*
+ * Print to the console. Understands %d, %u, %x, %p, %s, %c and the
+ * l size prefix for 64-bit %ld, %lu and %lx.
  * Parameters:
  *  - fmt: The format string.
  *  - ...: The values to format according to the format string.
@@ -48,6 +161,28 @@ void uartflush(void);
  */
 void printf(char *fmt, ...);
 
+/*
+ * Print directly to the UART, polling, bypassing PORT_CONSOLEOUT.
+ * Works with interrupts off and from panic; slow, since it waits
+ * for every character to go out.
+ * Parameters:
+ *  - fmt: The format string.
+ *  - ...: The values to format according to the format string.
+ * Returns: None
+ */
+void uartprintf(char *fmt, ...);
+
+/*
+ * Print to the console's urgent lane, ahead of anything already
+ * waiting in PORT_CONSOLEOUT. For warnings that an operator needs to
+ * see now; the lane is small, so keep messages short.
+ * Parameters:
+ *  - fmt: The format string.
+ *  - ...: The values to format according to the format string.
+ * Returns: None
+ */
+void printf_urgent(char *fmt, ...);
+
 /*
  * Print to the specified port
  * Parameters:
@@ -58,6 +193,48 @@ void printf(char *fmt, ...);
  */
 void pprintf(int port, char *fmt, ...);
 
+/*
+ * Format into a memory buffer, with the same conversions as printf.
+ * At most size-1 characters are stored and the result is always
+ * null terminated (if size > 0).
+ * Parameters:
+ *  - buf: The destination buffer.
+ *  - size: The size of buf in bytes.
+ *  - fmt: The format string.
+ *  - ...: The values to format according to the format string.
+ * Returns:
+ *  - The length of the fully formatted string, which is size or
+ *    more if the output was truncated.
+ */
+int snprintf(char *buf, int size, char *fmt, ...);
+
+/*
+ * snprintf with the arguments passed as a va_list.
+ */
+int vsnprintf(char *buf, int size, char *fmt, va_list ap);
+
+/*
+ * Turn the per-line console timestamp on or off. When on, each line
+ * printf writes to PORT_CONSOLEOUT starts with "[usec] ", the
+ * microseconds since boot at the time of the printf call.
+ * Parameters:
+ *  - on: Non-zero to enable timestamps, zero to disable them.
+ * Returns: None
+ */
+void printf_timestamps(int on);
+
+/*
+ * Write bytes to PORT_CONSOLEOUT as console output, so that printf
+ * knows whether they left the console at the start of a line. Use
+ * it rather than port_write for text that goes between printfs,
+ * such as the echo of input. Does not start the UART.
+ * Parameters:
+ *  - buf: The bytes.
+ *  - n: How many.
+ * Returns: None
+ */
+void consolewrite(char *buf, int n);
+
 /*
  * Panic! Print one last plea for help and then hardlock the kernel.
  * Parameters:
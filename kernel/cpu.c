@@ -0,0 +1,24 @@
+//
+// per-hart state.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "proc.h"
+
+struct cpu cpus[NCPU];
+
+
+int
+cpuid(void)
+{
+  return r_tp();
+}
+
+
+struct cpu*
+mycpu(void)
+{
+  return &cpus[cpuid()];
+}
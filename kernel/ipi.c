@@ -0,0 +1,56 @@
+//
+// inter-processor interrupts.
+//
+// Supervisor mode cannot raise another hart's software interrupt,
+// so ipi_send sets the target's MSIP bit in the CLINT. timervec
+// takes the machine software interrupt, clears MSIP and raises SSIP,
+// and the target sees a supervisor software interrupt, as for a
+// timer tick. sent[] tells the two apart: it holds the mtime of the
+// first ipi_send not yet taken, or 0.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "ipi.h"
+
+static uint64 sent[NCPU];
+static struct ipistats stats[NCPU];
+
+
+void
+ipi_send(int hart)
+{
+  // keep the first send's time; later ones ride on the same
+  // interrupt.
+  __sync_val_compare_and_swap(&sent[hart], 0, r_time());
+  __sync_synchronize();
+  *(volatile uint32*)CLINT_MSIP(hart) = 1;
+}
+
+
+int
+ipi_intr(void)
+{
+  struct ipistats *st = &stats[cpuid()];
+  uint64 t, lat;
+
+  t = __sync_lock_test_and_set(&sent[cpuid()], 0);
+  if(t == 0)
+    return 0;
+  lat = r_time() - t;
+  st->received++;
+  st->lat += lat;
+  if(lat > st->lat_max)
+    st->lat_max = lat;
+  return 1;
+}
+
+
+void
+ipi_getstats(int hart, struct ipistats *st)
+{
+  *st = stats[hart];
+}
@@ -0,0 +1,42 @@
+#ifndef IPI_H
+#define IPI_H
+
+#include "types.h"
+
+/*
+ * Interrupt another hart. Its CLINT MSIP bit raises a machine
+ * software interrupt, which timervec passes on as a supervisor
+ * software interrupt, the same one the timer tick uses. A hart in
+ * wfi wakes; a hart running a process in user mode yields it.
+ * Parameters:
+ *  - hart: The hart to interrupt.
+ * Returns: None
+ */
+void ipi_send(int hart);
+
+/*
+ * Take this hart's pending IPI, if there is one. Called on every
+ * supervisor software interrupt, from ktrap and on a trap from user
+ * space, with interrupts off.
+ * Parameters: None
+ * Returns: Non-zero if the interrupt was, or included, an IPI.
+ */
+int ipi_intr(void);
+
+// IPI counters for one hart, as the receiver.
+struct ipistats {
+  uint64 received;  // IPIs taken
+  uint64 lat;       // mtime ticks from ipi_send to ipi_intr, in total
+  uint64 lat_max;
+};
+
+/*
+ * Copy out a hart's IPI counters.
+ * Parameters:
+ *  - hart: The hart.
+ *  - st: Where to store them.
+ * Returns: None
+ */
+void ipi_getstats(int hart, struct ipistats *st);
+
+#endif // IPI_H
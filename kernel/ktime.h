@@ -0,0 +1,80 @@
+#ifndef KTIME_H
+#define KTIME_H
+
+#include "types.h"
+#include "riscv.h"
+#include "memlayout.h"
+
+//
+// monotonic kernel time.
+//
+// the clock is the time CSR, a copy of the CLINT's mtime, which
+// counts from zero at reset. its rate is the timebase-frequency the
+// device tree gives for the cpus, 10MHz on qemu virt.
+//
+// conversions multiply by a 64-bit fixed-point factor and shift,
+// rather than divide: a divide is tens of cycles, and these run on
+// every trace event and console timestamp. results truncate, like
+// the divisions they replace. the factors are rounded up, so that a
+// conversion between rates that divide evenly is exact; the rounding
+// adds at most one unit per 2^40 ticks (30 hours at 10MHz).
+//
+
+#define KTIME_HZ CLINT_MTIME_HZ
+#define KTIME_SHIFT 40
+
+// the factors, (to / from) << KTIME_SHIFT rounded up, worked out
+// for a 10MHz clock; change them with KTIME_HZ. computing them in the
+// header would take a 128-bit divide, which only constant folding
+// keeps out of the kernel.
+_Static_assert(KTIME_HZ == 10000000, "ktime factors assume a 10MHz mtime");
+#define KTIME_MTIME_TO_NS 109951162777600ULL  // 100 << 40
+#define KTIME_MTIME_TO_US 109951162778ULL     // (1 << 40) / 10
+#define KTIME_NS_TO_MTIME 10995116278ULL      // (1 << 40) / 100
+#define KTIME_US_TO_MTIME 10995116277760ULL   // 10 << 40
+
+static inline uint64
+ktime_scale(uint64 x, uint64 mult)
+{
+  return ((unsigned __int128)x * mult) >> KTIME_SHIFT;
+}
+
+// mtime ticks to and from nanoseconds and microseconds.
+static inline uint64
+mtime_to_ns(uint64 t)
+{
+  return ktime_scale(t, KTIME_MTIME_TO_NS);
+}
+
+static inline uint64
+mtime_to_us(uint64 t)
+{
+  return ktime_scale(t, KTIME_MTIME_TO_US);
+}
+
+static inline uint64
+ns_to_mtime(uint64 ns)
+{
+  return ktime_scale(ns, KTIME_NS_TO_MTIME);
+}
+
+static inline uint64
+us_to_mtime(uint64 us)
+{
+  return ktime_scale(us, KTIME_US_TO_MTIME);
+}
+
+// time since reset.
+static inline uint64
+ktime_ns(void)
+{
+  return mtime_to_ns(r_time());
+}
+
+static inline uint64
+ktime_us(void)
+{
+  return mtime_to_us(r_time());
+}
+
+#endif // KTIME_H
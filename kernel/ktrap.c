@@ -0,0 +1,134 @@
+//
+// kernel-mode trap entry.
+//
+// stvec is in vectored mode, pointing at kernelvectbl (kernelvec.S).
+// Timer and device interrupts enter through kernelintrvec, which
+// saves only the caller-saved registers; exceptions and any other
+// trap go through kernelvec, which saves them all. Either calls
+// ktrap(), which
+// runs the hooks that have to see every trap taken in supervisor
+// mode, serves device interrupts through plic_dispatch(), hands
+// every other trap to kerneltrap() in trap.c, and then runs the
+// tasklets the handlers queued.
+//
+// Traps from user space enter through uservec and userenter()
+// (scheduler.c), which calls ktrap_user() to give interrupts the same
+// handling before the precompiled usertrap() sees them.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "trap.h"
+#include "timer.h"
+#include "trace.h"
+#include "prof.h"
+#include "tasklet.h"
+#include "ipi.h"
+
+extern char kernelvec[], kernelvectbl[];
+
+// time (mtime ticks) at which each hart entered its current trap.
+uint64 trapstart[NCPU];
+
+// regs points at the registers kernelvec saved, in the order it
+// stores them; the interrupted frame pointer, s0, is regs[KV_S0].
+// kernelintrvec fills in only the caller-saved slots and s0.
+#define KV_S0 7
+
+void
+ktrapvec(int vectored)
+{
+  if(vectored)
+    w_stvec((uint64)kernelvectbl | STVEC_VECTORED);
+  else
+    w_stvec((uint64)kernelvec);
+}
+
+// Run the tasklets the handlers queued, with interrupts on. a trap
+// taken meanwhile overwrites sepc, scause and sstatus, which the
+// interrupted trap still needs, so keep them.
+static void
+run_tasklets(void)
+{
+  uint64 sepc, scause, sstatus;
+
+  if(!tasklet_pending())
+    return;
+  sepc = r_sepc();
+  scause = r_scause();
+  sstatus = r_sstatus();
+  tasklet_run();
+  intr_off();
+  w_sepc(sepc);
+  w_scause(scause);
+  w_sstatus(sstatus);
+}
+
+void
+ktrap(uint64 *regs)
+{
+  uint64 scause = r_scause();
+
+  trapstart[r_tp()] = r_time();
+  trace(TR_TRAP_ENTER, scause, r_sepc());
+
+  if(scause == SCAUSE_SEI){
+    // device interrupts never yield, so none of kerneltrap()'s
+    // bookkeeping is needed; plic_dispatch() serves all that are
+    // pending instead of devintr()'s one per trap.
+    plic_dispatch();
+  } else {
+    // an IPI arrives as a supervisor software interrupt too; the
+    // wakeup it carries needs nothing more than the trap itself.
+    if(scause == SCAUSE_SSI)
+      ipi_intr();
+
+    // timer ticks arrive as supervisor software interrupts that
+    // timervec marks, or with Sstc as supervisor timer interrupts.
+    // clockintr() gets a look before kerneltrap() acknowledges them.
+    if(scause == SCAUSE_STI || (scause == SCAUSE_SSI && timer_ticked())){
+      if(profiling)
+        prof_tick(r_sepc(), regs[KV_S0], (uint64)regs);
+      clockintr();
+    }
+
+    // devintr() only knows the software-interrupt tick. clockintr()
+    // has already cleared an Sstc interrupt by writing stimecmp, so
+    // pass it on as a tick, which still yields.
+    if(scause == SCAUSE_STI)
+      w_scause(SCAUSE_SSI);
+    kerneltrap();
+  }
+
+  // the handlers are done; run the work they deferred.
+  run_tasklets();
+
+  trace(TR_TRAP_EXIT, scause, 0);
+}
+
+void
+ktrap_user(void)
+{
+  uint64 scause = r_scause();
+
+  if(scause != SCAUSE_SEI && scause != SCAUSE_SSI && scause != SCAUSE_STI)
+    return;
+  trapstart[r_tp()] = r_time();
+
+  if(scause == SCAUSE_SEI){
+    // devintr() then claims nothing, and leaves it at that.
+    plic_dispatch();
+  } else {
+    if(scause == SCAUSE_SSI)
+      ipi_intr();
+    if(scause == SCAUSE_STI || timer_ticked())
+      clockintr();
+    // devintr() yields on a software interrupt, and knows no other
+    // tick. clear it now, so the tasklets do not take it again.
+    w_scause(SCAUSE_SSI);
+    w_sip(r_sip() & ~2);
+  }
+
+  run_tasklets();
+}
@@ -0,0 +1,326 @@
+//
+// locks for the port, page allocator and proc table code, which only
+// exists in libprecompiled.a and was written for one hart.
+//
+// The Makefile links with --wrap for the entry points below, so a
+// call to port_write goes to __wrap_port_write, which takes the lock
+// and calls the real one as __real_port_write. Calls the precompiled
+// code makes within one of its own files are not wrapped; those run
+// under the lock already taken on the way in.
+//
+// lock order: biglock (scheduler.c), then proclock, then vmlock;
+// biglock, then portlock, then a run queue lock.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "port.h"
+#include "mem.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "syscall.h"
+
+struct spinlock portlock;
+
+// processes whose last port_read found nothing, one bit per proc
+// slot, by port. guarded by portlock.
+static uint64 readers[NPORT];
+// the port each process is reading in sys_port_read, plus one, or 0.
+// only that read may put it to sleep: the kernel's own reads of an
+// empty port on its behalf, in uartstart or virtio_disk_start, must
+// not. private to the hart running the process.
+static int sysread[NPROC];
+static struct spinlock vmlock;
+static struct spinlock proclock;
+
+void __real_port_init(void);
+void __real_port_close(int port);
+int __real_port_acquire(int port, procid_t proc_id);
+int __real_port_read(int port, char *buf, int n);
+int __real_port_write(int port, char *buf, int n);
+
+void __real_vm_init(void);
+void *__real_vm_page_alloc(void);
+void __real_vm_page_free(void *pa);
+pagetable_t __real_vm_create_pagetable(void);
+pte_t *__real_walk_pgtable(pagetable_t pagetable, uint64 va, int alloc);
+int __real_vm_page_insert(pagetable_t pagetable, uint64 va, uint64 pa, int perm);
+int __real_vm_map_range(pagetable_t pagetable, uint64 va, uint64 size, int perm);
+void __real_vm_page_remove(pagetable_t pagetable, uint64 va, uint64 npages, int do_free);
+
+void __real_proc_init(void);
+struct proc *__real_proc_alloc(void);
+void __real_proc_free(struct proc *p);
+struct proc *__real_proc_find(int pid);
+
+void __real_syscall(void);
+
+
+//
+// ports[].
+//
+
+void
+__wrap_port_init(void)
+{
+  initlock(&portlock, "ports");
+  acquire(&portlock);
+  __real_port_init();
+  release(&portlock);
+}
+
+void
+__wrap_port_close(int port)
+{
+  acquire(&portlock);
+  __real_port_close(port);
+  release(&portlock);
+}
+
+int
+__wrap_port_acquire(int port, procid_t proc_id)
+{
+  int r;
+
+  acquire(&portlock);
+  r = __real_port_acquire(port, proc_id);
+  release(&portlock);
+  return r;
+}
+
+int
+__wrap_port_read(int port, char *buf, int n)
+{
+  struct proc *p;
+  int r;
+
+  acquire(&portlock);
+  r = __real_port_read(port, buf, n);
+  // sys_port_read yields until a read finds something. note who
+  // is waiting, so that yield can let it sleep and a write wake it.
+  p = mycpu()->proc;
+  if(r == 0 && p && port >= 0 && port < NPORT &&
+     sysread[p - proc] == port + 1){
+    p->wait_read = port + 1;
+    readers[port] |= 1UL << (p - proc);
+  }
+  release(&portlock);
+
+  trace(TR_PORT_READ, port << 16 | (r & 0xffff),
+        (uint64)__builtin_return_address(0));
+  return r;
+}
+
+// Wake the processes waiting to read port. Called with portlock
+// held.
+static void
+wake_readers(int port)
+{
+  uint64 m = readers[port];
+  struct proc *p;
+
+  readers[port] = 0;
+  while(m){
+    p = &proc[__builtin_ctzl(m)];
+    m &= m - 1;
+    p->wait_read = 0;
+    if(p->state == WAITING){
+      p->state = RUNNABLE;
+      sched_wakeup(p);
+    }
+  }
+}
+
+int
+__wrap_port_write(int port, char *buf, int n)
+{
+  int r;
+
+  acquire(&portlock);
+  r = __real_port_write(port, buf, n);
+  if(r > 0 && port >= 0 && port < NPORT && readers[port])
+    wake_readers(port);
+  release(&portlock);
+
+  trace(TR_PORT_WRITE, port << 16 | (r & 0xffff),
+        (uint64)__builtin_return_address(0));
+  return r;
+}
+
+int
+port_wait(struct proc *p)
+{
+  int slept = 0;
+
+  acquire(&portlock);
+  if(p->wait_read){
+    p->state = WAITING;
+    slept = 1;
+  }
+  release(&portlock);
+  return slept;
+}
+
+void
+port_unwait(struct proc *p)
+{
+  acquire(&portlock);
+  if(p->wait_read){
+    readers[p->wait_read - 1] &= ~(1UL << (p - proc));
+    p->wait_read = 0;
+  }
+  release(&portlock);
+}
+
+
+//
+// system calls.
+//
+
+// Note the port sys_port_read is reading for the process, for
+// __wrap_port_read.
+void
+__wrap_syscall(void)
+{
+  struct proc *p = mycpu()->proc;
+  struct trapframe *tf = p->trapframe;
+  int i = p - proc;
+
+  if(tf->a0 == SYS_PORT_READ && tf->a1 < NPORT)
+    sysread[i] = tf->a1 + 1;
+  __real_syscall();
+  sysread[i] = 0;
+}
+
+
+//
+// the page allocator and page tables.
+//
+
+void
+__wrap_vm_init(void)
+{
+  initlock(&vmlock, "vm");
+  acquire(&vmlock);
+  __real_vm_init();
+  release(&vmlock);
+}
+
+void*
+__wrap_vm_page_alloc(void)
+{
+  void *pa;
+
+  acquire(&vmlock);
+  pa = __real_vm_page_alloc();
+  release(&vmlock);
+  return pa;
+}
+
+void
+__wrap_vm_page_free(void *pa)
+{
+  acquire(&vmlock);
+  __real_vm_page_free(pa);
+  release(&vmlock);
+}
+
+pagetable_t
+__wrap_vm_create_pagetable(void)
+{
+  pagetable_t pt;
+
+  acquire(&vmlock);
+  pt = __real_vm_create_pagetable();
+  release(&vmlock);
+  return pt;
+}
+
+pte_t*
+__wrap_walk_pgtable(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte;
+
+  acquire(&vmlock);
+  pte = __real_walk_pgtable(pagetable, va, alloc);
+  release(&vmlock);
+  return pte;
+}
+
+int
+__wrap_vm_page_insert(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  int r;
+
+  acquire(&vmlock);
+  r = __real_vm_page_insert(pagetable, va, pa, perm);
+  release(&vmlock);
+  return r;
+}
+
+int
+__wrap_vm_map_range(pagetable_t pagetable, uint64 va, uint64 size, int perm)
+{
+  int r;
+
+  acquire(&vmlock);
+  r = __real_vm_map_range(pagetable, va, size, perm);
+  release(&vmlock);
+  return r;
+}
+
+void
+__wrap_vm_page_remove(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  acquire(&vmlock);
+  __real_vm_page_remove(pagetable, va, npages, do_free);
+  release(&vmlock);
+}
+
+
+//
+// the proc table.
+//
+
+void
+__wrap_proc_init(void)
+{
+  initlock(&proclock, "proc");
+  acquire(&proclock);
+  __real_proc_init();
+  release(&proclock);
+}
+
+struct proc*
+__wrap_proc_alloc(void)
+{
+  struct proc *p;
+
+  acquire(&proclock);
+  p = __real_proc_alloc();
+  release(&proclock);
+  if(p)
+    sched_newproc(p);
+  return p;
+}
+
+void
+__wrap_proc_free(struct proc *p)
+{
+  acquire(&proclock);
+  __real_proc_free(p);
+  release(&proclock);
+}
+
+struct proc*
+__wrap_proc_find(int pid)
+{
+  struct proc *p;
+
+  acquire(&proclock);
+  p = __real_proc_find(pid);
+  release(&proclock);
+  return p;
+}
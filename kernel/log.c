@@ -0,0 +1,29 @@
+//
+// run-time state for the leveled logging macros in log.h.
+//
+
+#include "types.h"
+#include "log.h"
+
+// errors, warnings and info for every subsystem.
+#define LOG_MASK_DEFAULT 0x0707070707070707UL
+
+uint64 log_mask = LOG_MASK_DEFAULT;
+
+void
+log_set_level(int sys, int lvl)
+{
+  uint64 bits;
+
+  if(sys < 0 || sys >= LOG_NSUBSYS)
+    return;
+  if(lvl < -1)
+    lvl = -1;
+  if(lvl > LOG_TRACE)
+    lvl = LOG_TRACE;
+
+  // levels 0..lvl of this subsystem's byte
+  bits = (1UL << (lvl + 1)) - 1;
+  log_mask &= ~(0xffUL << (sys*8));
+  log_mask |= (bits & 0xff) << (sys*8);
+}
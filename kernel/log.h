@@ -0,0 +1,64 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "types.h"
+#include "port.h"
+#include "console.h"
+
+// Leveled kernel logging on top of pprintf.
+//
+// A log site is dropped at compile time when its level is above
+// LOG_LEVEL (set with "make LOGLEVEL=n"), so trace calls cost nothing
+// in a normal build. Sites that survive are gated at run time by
+// log_mask, which has one bit per (subsystem, level) pair; the check
+// is a single load and branch before any arguments are evaluated.
+
+// Log levels, most to least severe.
+#define LOG_ERROR 0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4
+
+// Subsystems. Each owns one byte of log_mask.
+#define LOG_UART  0
+#define LOG_DISK  1
+#define LOG_PORT  2
+#define LOG_TRAP  3
+#define LOG_SCHED 4
+#define LOG_NSUBSYS 8
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// The log_mask bit that enables level lvl for subsystem sys.
+#define LOG_BIT(sys, lvl) (1UL << ((sys)*8 + (lvl)))
+
+extern uint64 log_mask;
+
+#define klog(sys, lvl, fmt, ...)                                  \
+  do {                                                            \
+    if((lvl) <= LOG_LEVEL && (log_mask & LOG_BIT(sys, lvl)))      \
+      pprintf(PORT_CONSOLEOUT, fmt, ##__VA_ARGS__);               \
+  } while(0)
+
+#define log_error(sys, fmt, ...) klog(sys, LOG_ERROR, fmt, ##__VA_ARGS__)
+#define log_warn(sys, fmt, ...)  klog(sys, LOG_WARN, fmt, ##__VA_ARGS__)
+#define log_info(sys, fmt, ...)  klog(sys, LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_debug(sys, fmt, ...) klog(sys, LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define log_trace(sys, fmt, ...) klog(sys, LOG_TRACE, fmt, ##__VA_ARGS__)
+
+/*
+ * Set the run-time log level of a subsystem. Messages at lvl and
+ * more severe are printed; lvl of -1 silences the subsystem. lvl is
+ * clamped to -1..LOG_TRACE.
+ * Levels above the compile-time LOG_LEVEL stay compiled out.
+ * Parameters:
+ *  - sys: The subsystem (LOG_UART, LOG_DISK, ...).
+ *  - lvl: The least severe level to print.
+ * Returns: None
+ */
+void log_set_level(int sys, int lvl);
+
+#endif // LOG_H
@@ -9,32 +9,155 @@
 #include "disk.h"
 #include "string.h"
 #include "tests.h"
+#include "trace.h"
+#include "prof.h"
+#include "ktime.h"
+#include "timer.h"
+#include "tasklet.h"
+#include "spinlock.h"
 
 void swtch(struct context *old, struct context *new);
 
-// start() jumps here in supervisor mode
+extern uint64 boot_start;  // start.c
+
+// when each init phase finished, in mtime ticks.
+#define NBOOTPHASE 8
+static struct {
+  char *name;
+  uint64 end;
+} bootphase[NBOOTPHASE];
+static int nbootphase;
+
+// Mark the end of an init phase.
+static void
+boot_phase(char *name)
+{
+  if(nbootphase < NBOOTPHASE){
+    bootphase[nbootphase].name = name;
+    bootphase[nbootphase].end = r_time();
+    nbootphase++;
+  }
+}
+
+// Print how long each init phase took, in microseconds.
+// "start" is the machine-mode setup in start.c, up to main.
+static void
+boot_report(void)
+{
+  uint64 prev = boot_start;
+  int i;
+
+  printf("boot:");
+  for(i = 0; i < nbootphase; i++){
+    printf(" %s %luus", bootphase[i].name,
+           mtime_to_us(bootphase[i].end - prev));
+    prev = bootphase[i].end;
+  }
+  printf(", total %luus\n", mtime_to_us(prev - boot_start));
+}
+
+// set by hart 0 once the shared kernel state is ready.
+static volatile int started;
+
+// Bring up a hart other than 0, once hart 0 has set up the kernel:
+// its own trap vector, page table, timers and PLIC context. It then
+// runs processes from its run queue, or steals them, serving the
+// timers and interrupts routed to it while idle.
+static void
+hartmain(void)
+{
+  while(started == 0)
+    ;
+  __sync_synchronize();
+
+  trapinit();
+  ktrapvec(1);
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  timer_inithart();
+  plicinithart();
+  printf("hart %d starting\n", cpuid());
+
+  scheduler();
+}
+
+// start() jumps here in supervisor mode, on every hart.
 void
 main()
 {
+  if(cpuid() != 0)
+    hartmain();
+
+  boot_phase("start");
+  tasklet_init();
+  sched_init();
+
   // initialize ports
   port_init();
+  boot_phase("port_init");
+
+#ifdef TRACE
+  // record from here on; panic prints the ring.
+  trace_start();
+#endif
+#ifdef PROF
+  // sample with backtraces from here on; panic prints the samples.
+  prof_start(1);
+#endif
 
   // initialize uart
   uartinit();
+  boot_phase("uartinit");
   printf("\n");
   printf("HAWX kernel is booting\n");
   printf("\n");
   uartflush();
+  boot_phase("banner");
 
   // initialize traps
   trapinit();
+  ktrapvec(1);
+  boot_phase("trapinit");
 
   //initialize virtual memory
   vm_init();
+  boot_phase("vm_init");
+
+  // start the kernel timers; they need the CLINT mapped.
+  timer_init();
+  boot_phase("timer_init");
 
   //initialize the device interrupts
   plicinit();
+  boot_phase("plicinit");
+
+  // let the other harts in.
+  __sync_synchronize();
+  started = 1;
+
+  boot_report();
+  uartflush();
+
+#ifdef BENCH
+  bench_printint();
+  bench_uart();
+  bench_ports();
+  bench_timer();
+  bench_masking();
+  bench_trapentry();
+  bench_ipi();
+  test_port_wait();
+  bench_pingpong();
+  plic_stats();
+  lock_stats();
+  sched_stats();
+  panic("Benchmarks done");
+#endif
 
+#ifdef STRESS
+  stress_console();
+  panic("Stress done");
+#endif
 
   //test the UART
   test_uart();
@@ -0,0 +1,6 @@
+#ifndef PARAM_H
+#define PARAM_H
+
+#define NCPU 8  // maximum number of harts
+
+#endif // PARAM_H
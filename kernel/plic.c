@@ -1,28 +1,244 @@
 #include "types.h"
 #include "memlayout.h"
 #include "riscv.h"
+#include "param.h"
+#include "console.h"
+#include "string.h"
+#include "trap.h"
+#include "trace.h"
+#include "log.h"
+#include "disk.h"
+#include "tasklet.h"
+#include "spinlock.h"
 
 //
 // the riscv Platform Level Interrupt Controller (PLIC).
 //
 
+#define NIRQ 64         // interrupt sources tracked; qemu virt has 53
+#define NBUCKET 32      // log2 histogram buckets
+#define MAXPRIO 7       // qemu virt implements 3 priority bits
+
+// device interrupt handlers, by IRQ; see irq_register.
+static void (*handlers[NIRQ])(void);
+
+// harts each IRQ is routed to, one bit per hart.
+static uint64 affinity[NIRQ];
+
+// guards the enable words: one word holds several IRQs, and any
+// hart may change another's, in irq_set_affinity.
+static struct spinlock enablelock;
+
+// claims by hart, to check how interrupt load is spread.
+static uint64 hartclaims[NCPU][NIRQ];
+
+// per-IRQ timing, in mtime ticks. bucket b counts times t
+// with 2^(b-1) <= t < 2^b; bucket 0 counts t == 0.
+struct irqstat {
+  uint64 claims;
+  uint64 service[NBUCKET];  // claim to complete
+  uint64 wait[NBUCKET];     // trap entry to claim
+  uint64 service_max;
+  uint64 wait_max;
+};
+
+static struct irqstat irqstats[NIRQ];
+static uint64 claimed_at[NCPU];  // when each hart claimed its current irq
+
+static int
+bucket(uint64 t)
+{
+  int b = t ? 64 - __builtin_clzl(t) : 0;
+  return b < NBUCKET ? b : NBUCKET - 1;
+}
+
+static void setenable(int hart, int irq, int on);
+static void complete(int hart, int irq, uint64 claimed);
+
+// set by a handler that will complete its IRQ later; see
+// plic_dispatch.
+static int deferred[NCPU];
+
+// virtio_disk_intr does the completion work for every finished
+// request, port writes included, so it runs as a tasklet. the disk
+// holds its interrupt line up until virtio_disk_intr acknowledges
+// it, so the IRQ stays claimed, and so not delivered again, until
+// the tasklet completes it on the hart that claimed it. the tasklet
+// may run on another hart. the enable bit stays set throughout: a
+// PLIC ignores a completion for a source not enabled for the target.
+static int diskhart;
+static uint64 diskclaimed;
+
+static void
+diskwork(struct tasklet *t)
+{
+    virtio_disk_intr();
+    complete(diskhart, VIRTIO0_IRQ, diskclaimed);
+}
+
+static struct tasklet disktasklet = { .fn = diskwork };
+
+static void
+diskintr(void)
+{
+    diskhart = r_tp();
+    diskclaimed = claimed_at[diskhart];
+    deferred[diskhart] = 1;
+    tasklet_schedule(&disktasklet);
+}
+
+
 void
 plicinit(void)
 {
+    initlock(&enablelock, "plicenable");
+    irq_register(UART0_IRQ, uartintr, 1);
+    irq_register(VIRTIO0_IRQ, diskintr, 1);
+
+    plicinithart();
+}
+
+
+// Set up the calling hart's S-mode context: enable exactly the
+// IRQs routed to it, and accept any priority.
+void
+plicinithart(void)
+{
+    int hart = r_tp();
+    uint32 *enable = (uint32*)PLIC_SENABLE(hart);
+
+    acquire(&enablelock);
+    enable[0] = enable[1] = 0;
+    for(int irq = 1; irq < NIRQ; irq++){
+      if(handlers[irq] && (affinity[irq] & (1UL << hart)))
+        enable[irq / 32] |= 1 << (irq % 32);
+    }
+    release(&enablelock);
+
+    plic_set_threshold(hart, 0);
+}
+
+
+// Install handler for irq and give it a priority. Unless it has
+// already been routed elsewhere, route it to this hart.
+int
+irq_register(int irq, void (*handler)(void), int priority)
+{
+    if(irq <= 0 || irq >= NIRQ || handler == 0)
+      return -1;
+    if(priority < 1 || priority > MAXPRIO)
+      return -1;
+
+    handlers[irq] = handler;
+
+    // a source with priority 0 never interrupts.
+    *(uint32*)(PLIC_PRIORITY + irq*4) = priority;
+
+    return irq_set_affinity(irq, affinity[irq] ? affinity[irq] : 1UL << r_tp());
+}
+
+
+// Route irq to the harts in mask, and away from all others. The
+// PLIC hands a pending IRQ to one enabled hart, so with several
+// set they share the load.
+int
+irq_set_affinity(int irq, uint64 mask)
+{
+    uint64 changed;
     int hart;
 
-    // set desired IRQ priorities non-zero (otherwise disabled).
-    *(uint32*)(PLIC + UART0_IRQ*4) = 1;
-    *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+    if(irq <= 0 || irq >= NIRQ || mask == 0 || (mask >> NCPU) != 0)
+      return -1;
 
-    //initialize the hart
-    hart = r_tp();
+    // only touch harts whose routing changes, so a mask never
+    // writes the context of a hart that does not exist.
+    changed = affinity[irq] ^ mask;
+    affinity[irq] = mask;
+    for(hart = 0; hart < NCPU; hart++){
+      if(changed & (1UL << hart))
+        setenable(hart, irq, (mask >> hart) & 1);
+    }
+    return 0;
+}
 
-    // set uart's enable bit for this hart's S-mode. 
-    *(uint32*)PLIC_SENABLE(hart)= (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
 
-    // set this hart's S-mode priority threshold to 0.
-    *(uint32*)PLIC_SPRIORITY(hart) = 0;
+uint64
+irq_affinity(int irq)
+{
+    if(irq <= 0 || irq >= NIRQ)
+      return 0;
+    return affinity[irq];
+}
+
+
+// Set or clear irq's enable bit in hart's supervisor context.
+static void
+setenable(int hart, int irq, int on)
+{
+    uint32 *enable = (uint32*)PLIC_SENABLE(hart) + irq / 32;
+
+    acquire(&enablelock);
+    if(on)
+      *enable |= 1 << (irq % 32);
+    else
+      *enable &= ~(1 << (irq % 32));
+    release(&enablelock);
+}
+
+
+// Mask irq on this hart, without changing where it is routed.
+void
+irq_disable(int irq)
+{
+    setenable(r_tp(), irq, 0);
+}
+
+
+// Undo irq_disable, if irq is routed to this hart.
+void
+irq_enable(int irq)
+{
+    if(affinity[irq] & (1UL << r_tp()))
+      setenable(r_tp(), irq, 1);
+}
+
+
+// Only IRQs with a priority above hart's threshold interrupt it.
+void
+plic_set_threshold(int hart, int threshold)
+{
+    *(uint32*)PLIC_SPRIORITY(hart) = threshold;
+}
+
+
+int
+plic_threshold(int hart)
+{
+    return *(uint32*)PLIC_SPRIORITY(hart);
+}
+
+
+// Serve every pending device interrupt: keep claiming until the
+// PLIC has nothing left for this hart, so back-to-back interrupts
+// cost one trap instead of several. Returns the number served.
+// A handler that leaves work to a tasklet may set deferred[] to
+// keep its IRQ claimed until the tasklet completes it.
+int
+plic_dispatch(void)
+{
+    int hart = r_tp();
+    int irq, n;
+
+    for(n = 0; (irq = plic_claim()) != 0; n++){
+      deferred[hart] = 0;
+      if(irq < NIRQ && handlers[irq])
+        handlers[irq]();
+      else
+        log_error(LOG_TRAP, "plic: unexpected irq %d\n", irq);
+      if(!deferred[hart])
+        plic_complete(irq);
+    }
+    return n;
 }
 
 
@@ -32,6 +248,19 @@ plic_claim(void)
 {
     int hart = r_tp();
     int irq = *(uint32*)PLIC_SCLAIM(hart);
+    uint64 now = r_time();
+    struct irqstat *st;
+
+    trace(TR_PLIC_CLAIM, irq, 0);
+    if(irq > 0 && irq < NIRQ){
+      st = &irqstats[irq];
+      st->claims++;
+      hartclaims[hart][irq]++;
+      st->wait[bucket(now - trapstart[hart])]++;
+      if(now - trapstart[hart] > st->wait_max)
+        st->wait_max = now - trapstart[hart];
+    }
+    claimed_at[hart] = now;
     return irq;
 }
 
@@ -39,6 +268,57 @@ plic_claim(void)
 void
 plic_complete(int irq)
 {
-    int hart = r_tp();
+    complete(r_tp(), irq, claimed_at[r_tp()]);
+}
+
+// complete irq in hart's context, which claimed it at mtime claimed.
+static void
+complete(int hart, int irq, uint64 claimed)
+{
+    uint64 t = r_time() - claimed;
+    struct irqstat *st;
+
+    trace(TR_PLIC_COMPLETE, irq, hart);
     *(uint32*)PLIC_SCLAIM(hart) = irq;
+
+    if(irq > 0 && irq < NIRQ){
+      st = &irqstats[irq];
+      st->service[bucket(t)]++;
+      if(t > st->service_max)
+        st->service_max = t;
+    }
+}
+
+
+void
+plic_stats(void)
+{
+  struct irqstat *st;
+
+  for(int irq = 0; irq < NIRQ; irq++){
+    st = &irqstats[irq];
+    if(st->claims == 0)
+      continue;
+    printf("irq %d: %lu claims, service max %lu, wait max %lu (mtime ticks)\n",
+           irq, st->claims, st->service_max, st->wait_max);
+    printf("  by hart:");
+    for(int hart = 0; hart < NCPU; hart++){
+      if(hartclaims[hart][irq])
+        printf(" %d:%lu", hart, hartclaims[hart][irq]);
+    }
+    printf("\n");
+    printf("  %10s %10s %10s\n", "< ticks", "service", "wait");
+    for(int b = 0; b < NBUCKET; b++){
+      if(st->service[b] || st->wait[b])
+        printf("  %10lu %10lu %10lu\n", 1UL << b, st->service[b], st->wait[b]);
+    }
+  }
+}
+
+
+void
+plic_stats_reset(void)
+{
+  memset(irqstats, 0, sizeof(irqstats));
+  memset(hartclaims, 0, sizeof(hartclaims));
 }
@@ -2,6 +2,7 @@
 #define PORT_H
 
 #include "types.h"
+#include "spinlock.h"
 
 // Ports for IPC
 #define NPORT 256          // Number of ports
@@ -82,4 +83,29 @@ struct port {
 // The ports array
 extern struct port ports[];
 
+// Guards ports[]; the port calls take it themselves. Hold it to
+// change a port's buffer directly.
+extern struct spinlock portlock;
+
+struct proc;
+
+/*
+ * Put a process to sleep if its last port_read found nothing and no
+ * port_write to that port has come since; the write makes it
+ * RUNNABLE again and calls sched_wakeup. Called from yield.
+ * Parameters:
+ *  - p: The process, RUNNING on this hart.
+ * Returns: 1 if p is now WAITING, 0 if it should stay runnable.
+ */
+int port_wait(struct proc *p);
+
+/*
+ * Forget that p's last port_read found nothing, so a later yield
+ * does not put it to sleep.
+ * Parameters:
+ *  - p: The process.
+ * Returns: None
+ */
+void port_unwait(struct proc *p);
+
 #endif // PORT_H
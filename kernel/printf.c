@@ -1,19 +1,116 @@
 //
-// formatted console output -- printf, panic.
+// formatted output -- printf, pprintf, snprintf, panic.
 //
 
 #include <stdarg.h>
 
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
+#include "ktime.h"
 #include "console.h"
 #include "port.h"
 #include "string.h"
+#include "trace.h"
+#include "prof.h"
 
 volatile int panicked = 0;
 
 static char digits[] = "0123456789abcdef";
 
+static int stamping;         // prefix console lines with a timestamp?
+static int console_bol = 1;  // next console character starts a line?
+
+// Where printf_driver sends its output. Every sink supplies a write
+// function; the remaining fields belong to particular kinds of sink.
+// The format engine only ever calls write, so ports, memory buffers
+// and the raw UART all share one formatting path.
+struct sink {
+  void (*write)(struct sink *s, char *buf, int n);
+  int console;  // output goes to the console; may be timestamped
+  int stamp;    // console sink: start each line with a timestamp
+  uint64 now;   // console sink: the time for it, in mtime ticks
+  int port;     // port sink: destination port
+  char *buf;    // buffer sink: destination buffer
+  int size;     // buffer sink: capacity, including the terminating NUL
+  int len;      // buffer sink: bytes produced, even if they didn't fit
+};
+
+
+// Write to PORT_CONSOLEOUT a line at a time, keeping track of
+// whether the next character starts a line, whatever the text came
+// from: a format literal, a %s or %c argument, or the echo of input.
+// If stamp is set, each line that starts here gets the "[usec] "
+// prefix, for now in mtime ticks.
+static void
+console_out(char *buf, int n, int stamp, uint64 now)
+{
+  char pre[24];
+  int j;
+
+  while(n > 0){
+    if(stamp && console_bol)
+      port_write(PORT_CONSOLEOUT, pre,
+                 snprintf(pre, sizeof(pre), "[%10lu] ", mtime_to_us(now)));
+    for(j = 0; j < n; )
+      if(buf[j++] == '\n')
+        break;
+    port_write(PORT_CONSOLEOUT, buf, j);
+    console_bol = buf[j-1] == '\n';
+    buf += j;
+    n -= j;
+  }
+}
+
+void
+consolewrite(char *buf, int n)
+{
+  console_out(buf, n, 0, 0);
+}
+
+static void
+sink_port_write(struct sink *s, char *buf, int n)
+{
+  if(s->console)
+    console_out(buf, n, s->stamp, s->now);
+  else
+    port_write(s->port, buf, n);
+}
+
+static void
+sink_buf_write(struct sink *s, char *buf, int n)
+{
+  int room = s->size - 1 - s->len;
+
+  if(room > n)
+    room = n;
+  if(room > 0)
+    memmove(s->buf + s->len, buf, room);
+  s->len += n;
+}
+
+static void
+sink_uart_write(struct sink *s, char *buf, int n)
+{
+  while(n-- > 0)
+    uartputc(*buf++);
+}
+
+static void
+sink_urgent_write(struct sink *s, char *buf, int n)
+{
+  uarturgent(buf, n);
+}
+
+static void
+sink_port(struct sink *s, int port)
+{
+  s->write = sink_port_write;
+  s->console = port == PORT_CONSOLEOUT;
+  s->stamp = 0;
+  s->port = port;
+}
+
 
 static int get_padding(char *fmt, int *i)
 {
@@ -34,51 +131,102 @@ static int get_padding(char *fmt, int *i)
 }
 
 
-static void print_padding(int port, int padding, int len)
+static void print_padding(struct sink *s, int padding, int len)
 {
+  static char spaces[] = "                ";
+  int n;
+
   if(padding < 0) {
     padding *= -1;
   }
 
-  for (int i = 0; i < padding - len; i++)
-    port_write(port, " ", 1);
+  for (n = padding - len; n > 0; n -= sizeof(spaces) - 1)
+    s->write(s, spaces, n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1);
+}
+
+
+// two decimal digits per entry, so the conversion loop retires two
+// digits per division. "07" is at offset 2*7, "42" at offset 2*42.
+static char digits100[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+
+// Convert x to text, writing backwards from end. Returns a pointer to
+// the most significant digit. Hex is pure shift/mask, and decimal
+// divides by the constant 100, which the compiler turns into a
+// multiply, so neither path issues a divide instruction per digit.
+static char*
+fmtuint(char *end, uint64 x, int base)
+{
+  char *p = end;
+  uint r;
+
+  if(base == 16){
+    do {
+      *--p = digits[x & 0xf];
+    } while((x >>= 4) != 0);
+    return p;
+  }
+
+  while(x >= 100){
+    r = x % 100;
+    x /= 100;
+    p -= 2;
+    p[0] = digits100[2*r];
+    p[1] = digits100[2*r + 1];
+  }
+
+  if(x >= 10){
+    p -= 2;
+    p[0] = digits100[2*x];
+    p[1] = digits100[2*x + 1];
+  } else {
+    *--p = '0' + x;
+  }
+
+  return p;
 }
 
 
 static void
-printint(int port, int xx, int base, int sign, int padding)
+printint(struct sink *s, long xx, int base, int sign, int padding)
 {
-  char buf[16];
-  int i;
-  uint x;
+  char buf[24];
+  char *p;
+  uint64 x;
   int len;
 
   if(sign && (sign = xx < 0))
-    x = -xx;
+    x = -(uint64)xx;
   else
     x = xx;
 
-  i = 0;
-  do {
-    buf[i++] = digits[x % base];
-  } while((x /= base) != 0);
+  p = fmtuint(buf + sizeof(buf), x, base);
 
   if(sign)
-    buf[i++] = '-';
+    *--p = '-';
 
-  len = i;
+  len = buf + sizeof(buf) - p;
   if(padding > 0)
-    print_padding(port, padding, len);
+    print_padding(s, padding, len);
 
-  while(--i >= 0)
-    port_write(port, buf + i, 1);
+  s->write(s, p, len);
 
   if(padding < 0)
-    print_padding(port, padding, len);
+    print_padding(s, padding, len);
 }
 
 static void
-printptr(int port, uint64 x, int padding)
+printptr(struct sink *s, uint64 x, int padding)
 {
   int i;
   char buf[16];
@@ -87,92 +235,120 @@ printptr(int port, uint64 x, int padding)
     buf[i] = digits[x >> (sizeof(uint64) * 8 - 4)];
 
   if(padding > 0)
-    print_padding(port, padding, i+2);
+    print_padding(s, padding, i+2);
 
-  port_write(port, "0x", 2);
-  port_write(port, buf, i);
+  s->write(s, "0x", 2);
+  s->write(s, buf, i);
 
   if(padding < 0)
-    print_padding(port, padding, i+2);
+    print_padding(s, padding, i+2);
 }
 
 
 static void
-printstr(int port, char *s, int padding)
+printstr(struct sink *s, char *str, int padding)
 {
   int len;
 
-  if(s == 0)
-    s = "(null)";
-  len = strlen(s);
+  if(str == 0)
+    str = "(null)";
+  len = strlen(str);
 
   if(padding > 0)
-    print_padding(port, padding, len);
+    print_padding(s, padding, len);
 
-  while(*s)
-    port_write(port, s++, 1);
+  s->write(s, str, len);
 
   if(padding < 0)
-    print_padding(port, padding, len);
+    print_padding(s, padding, len);
 }
 
 
 static void 
-printchar(int port, int c, int padding)
+printchar(struct sink *s, int c, int padding)
 {
   if(padding > 0)
-    print_padding(port, padding, 1);
+    print_padding(s, padding, 1);
 
-  port_write(port, (char*)&c, 1);
+  s->write(s, (char*)&c, 1);
 
   if(padding < 0)
-    print_padding(port, padding, 1);
+    print_padding(s, padding, 1);
 }
 
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Format into a sink. only understands %d, %u, %x, %p, %s, %c,
+// with an optional l (or ll) size prefix on %d, %u and %x.
 static void
-printf_driver(int port, char *fmt, va_list ap) 
+printf_driver(struct sink *s, char *fmt, va_list ap) 
 {
-  int i, c;
+  int i, j, c;
   int padding;
+  int lng;
 
   if (fmt == 0)
     panic("null fmt");
 
+  // read the clock once, now, so every line of this call carries
+  // the time of the event rather than the time the UART drains it.
+  if(s->console && stamping){
+    s->stamp = 1;
+    s->now = r_time();
+  }
+
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      port_write(port, (char*) &c, 1);
+      // write literal text up to the next conversion, or through
+      // the end of the line, in one go.
+      for(j = i; fmt[j] && fmt[j] != '%'; )
+        if(fmt[j++] == '\n')
+          break;
+      s->write(s, fmt + i, j - i);
+      i = j - 1;
       continue;
     }
     i++;
     padding = get_padding(fmt, &i);
+    for(lng = 0; fmt[i] == 'l'; i++)
+      lng = 1;
     c = fmt[i] & 0xff;
     if(c == 0)
       break;
     switch(c){
     case 'c':
-      printchar(port, va_arg(ap, int), padding);
+      printchar(s, va_arg(ap, int), padding);
       break;
     case 'd':
-      printint(port, va_arg(ap, int), 10, 1, padding);
+      if(lng)
+        printint(s, va_arg(ap, long), 10, 1, padding);
+      else
+        printint(s, va_arg(ap, int), 10, 1, padding);
+      break;
+    case 'u':
+      if(lng)
+        printint(s, va_arg(ap, uint64), 10, 0, padding);
+      else
+        printint(s, va_arg(ap, uint), 10, 0, padding);
       break;
     case 'x':
-      printint(port, va_arg(ap, int), 16, 1, padding);
+      if(lng)
+        printint(s, va_arg(ap, uint64), 16, 0, padding);
+      else
+        printint(s, va_arg(ap, uint), 16, 0, padding);
       break;
     case 'p':
-      printptr(port, va_arg(ap, uint64), padding);
+      printptr(s, va_arg(ap, uint64), padding);
       break;
     case 's':
-      printstr(port, va_arg(ap, char*), padding);
+      printstr(s, va_arg(ap, char*), padding);
       break;
     case '%':
-      printchar(port, '%', padding);
+      printchar(s, '%', padding);
       break;
     default:
       // Print unknown % sequence to draw attention.
-      port_write(port, "%", 1);
-      port_write(port, (char*)&c, 1);
+      s->write(s, "%", 1);
+      s->write(s, (char*)&c, 1);
       break;
     }
   }
@@ -180,18 +356,93 @@ printf_driver(int port, char *fmt, va_list ap)
 
 void printf(char *fmt, ...)
 {
+  struct sink s;
   va_list ap;
+
+  // the UART drains PORT_CONSOLEOUT from its interrupt.
+  uartmask();
+  sink_port(&s, PORT_CONSOLEOUT);
   va_start(ap, fmt);
-  printf_driver(PORT_CONSOLEOUT, fmt, ap);
+  printf_driver(&s, fmt, ap);
   va_end(ap);
-  uartstart();
+  uartkick();
+  uartunmask();
 }
 
 void pprintf(int port, char *fmt, ...)
 {
+  struct sink s;
+  va_list ap;
+
+  sink_port(&s, port);
+  if(s.console)
+    uartmask();
+  va_start(ap, fmt);
+  printf_driver(&s, fmt, ap);
+  va_end(ap);
+  if(s.console)
+    uartunmask();
+}
+
+void
+printf_urgent(char *fmt, ...)
+{
+  struct sink s;
+  va_list ap;
+
+  s.write = sink_urgent_write;
+  s.console = 0;
+  va_start(ap, fmt);
+  printf_driver(&s, fmt, ap);
+  va_end(ap);
+}
+
+int
+vsnprintf(char *buf, int size, char *fmt, va_list ap)
+{
+  struct sink s;
+
+  s.write = sink_buf_write;
+  s.console = 0;
+  s.buf = buf;
+  s.size = size;
+  s.len = 0;
+  printf_driver(&s, fmt, ap);
+
+  if(size > 0)
+    buf[s.len < size ? s.len : size - 1] = '\0';
+  return s.len;
+}
+
+int
+snprintf(char *buf, int size, char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+void
+printf_timestamps(int on)
+{
+  stamping = on;
+}
+
+// printf straight to the UART, polling, for when nothing else works.
+void
+uartprintf(char *fmt, ...)
+{
+  struct sink s;
   va_list ap;
+
+  s.write = sink_uart_write;
+  s.console = 0;
   va_start(ap, fmt);
-  printf_driver(port, fmt, ap);
+  printf_driver(&s, fmt, ap);
   va_end(ap);
 }
 
@@ -199,13 +450,22 @@ void pprintf(int port, char *fmt, ...)
 void
 panic(char *s)
 {
-  const char *panic_msg = "panic: ";
+  static int nested;
+
+  // flushing can panic in turn, e.g. on a lock this hart already
+  // holds; then just say why.
+  if(__sync_fetch_and_add(&nested, 1) > 0){
+    uartprintf("panic: %s\n", s);
+    for(;;)
+      ;
+  }
 
   uartflush();
-  while(*panic_msg) { uartputc(*panic_msg++); }
-  while(*s) { uartputc(*s++); }
-
-  uartputc('\n');
+  if(tracing)
+    trace_dump();
+  if(profiling)
+    prof_dump();
+  uartprintf("panic: %s\n", s);
   panicked = 1; // freeze uart output from other CPUs
   for(;;)
     ;
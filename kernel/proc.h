@@ -1,6 +1,7 @@
 #ifndef PROC_H
 #define PROC_H
 #include "types.h"
+#include "param.h"
 #include "riscv.h"
 
 // Saved registers for kernel context switches.
@@ -27,6 +28,8 @@ struct context {
 struct cpu {
   struct proc *proc;      // The process running on this cpu, or null.
   struct context context; // swtch() here to enter scheduler().
+  int noff;               // Depth of push_off() nesting.
+  int intena;             // Were interrupts enabled before push_off()?
 };
 
 // per-process data for the trap handling code in trampoline.S.
@@ -35,7 +38,8 @@ struct cpu {
 // the sscratch register points here.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
-// kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
+// kernel_sp, kernel_hartid, kernel_satp, and jumps to userenter()
+// in scheduler.c, which calls usertrap(); kernel_trap is unused.
 // usertrapret() and userret in trampoline.S set up
 // the trapframe's kernel_*, restore user registers from the
 // trapframe, switch to the user page table, and enter user space.
@@ -100,9 +104,27 @@ struct proc {
 
 // global proc variables
 #define NPROC 64
-extern struct cpu cpu;
 extern struct proc proc[];
 
+// per-hart state, indexed by hartid (cpu.c).
+extern struct cpu cpus[NCPU];
+
+// the cpu the precompiled trap and syscall code knows about. it was
+// built with only proc and context in struct cpu; leave the other
+// fields alone.
+extern struct cpu cpu;
+
+/*
+ * Returns: This hart's id, kept in tp. Call with interrupts off, so
+ * the caller cannot move to another hart before using it.
+ */
+int cpuid(void);
+
+/*
+ * Returns: This hart's struct cpu. Call with interrupts off.
+ */
+struct cpu *mycpu(void);
+
 ///////////////////////////////////////////////////////////////////////////////
 // Proc API
 ///////////////////////////////////////////////////////////////////////////////
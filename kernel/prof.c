@@ -0,0 +1,72 @@
+//
+// timer-driven sampling profiler. see prof.h.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "console.h"
+#include "prof.h"
+
+volatile int profiling;
+
+static int backtraces;
+static uint64 samples[PROF_NSAMPLE][PROF_DEPTH];
+static uint64 nsample;  // samples ever taken
+
+void
+prof_start(int backtrace)
+{
+  profiling = 0;
+  backtraces = backtrace;
+  nsample = 0;
+  profiling = 1;
+}
+
+void
+prof_stop(void)
+{
+  profiling = 0;
+}
+
+// With frame pointers, gcc stores a function's return address at
+// fp-8 and the caller's fp at fp-16. Leaf functions may save only
+// fp, so the first caller can be missed or wrong. The walk only
+// follows frames that lie above the trap frame (sp) within its stack
+// page, since the page above a kernel stack is an unmapped guard.
+void
+prof_tick(uint64 pc, uint64 fp, uint64 sp)
+{
+  uint64 *s = samples[nsample++ % PROF_NSAMPLE];
+  uint64 top = PGROUNDDOWN(sp) + PGSIZE;
+  int i;
+
+  s[0] = pc;
+  for(i = 1; i < PROF_DEPTH && backtraces; i++){
+    if(fp % 16 || fp - 16 < sp || fp > top)
+      break;
+    s[i] = ((uint64*)fp)[-1];
+    fp = ((uint64*)fp)[-2];
+  }
+  for(; i < PROF_DEPTH; i++)
+    s[i] = 0;
+}
+
+void
+prof_dump(void)
+{
+  uint64 i, first;
+  uint64 *s;
+
+  prof_stop();
+
+  first = nsample > PROF_NSAMPLE ? nsample - PROF_NSAMPLE : 0;
+  uartprintf("PROF-BEGIN n=%lu lost=%lu\n", nsample - first, first);
+  for(i = first; i < nsample; i++){
+    s = samples[i % PROF_NSAMPLE];
+    uartprintf("P");
+    for(int d = 0; d < PROF_DEPTH && s[d]; d++)
+      uartprintf(" %lx", s[d]);
+    uartprintf("\n");
+  }
+  uartprintf("PROF-END\n");
+}
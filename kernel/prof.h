@@ -0,0 +1,54 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "types.h"
+
+// Timer-driven sampling profiler.
+//
+// While running, every timer tick taken in the kernel records the
+// interrupted pc and, optionally, a frame-pointer backtrace (the
+// kernel is built with -fno-omit-frame-pointer). Code that runs with
+// interrupts off is never sampled. prof_dump() prints the samples
+// over the UART; utils/prof.py symbolizes them into a flat profile
+// and folded stacks for flamegraph.pl.
+
+#define PROF_NSAMPLE 1024  // samples kept; later ones overwrite the oldest
+#define PROF_DEPTH 8       // pcs per sample, interrupted pc first
+
+extern volatile int profiling;
+
+/*
+ * Start sampling, discarding earlier samples.
+ * Parameters:
+ *  - backtrace: Non-zero to walk frame pointers on each sample.
+ * Returns: None
+ */
+void prof_start(int backtrace);
+
+/*
+ * Stop sampling. The samples are kept.
+ * Parameters: None
+ * Returns: None
+ */
+void prof_stop(void);
+
+/*
+ * Record one sample. Called from ktrap on timer ticks.
+ * Parameters:
+ *  - pc: The interrupted pc (sepc).
+ *  - fp: The interrupted frame pointer (s0).
+ *  - sp: The stack pointer at the trap; frames are looked for above it.
+ * Returns: None
+ */
+void prof_tick(uint64 pc, uint64 fp, uint64 sp);
+
+/*
+ * Stop sampling and print the samples directly to the UART, one
+ * "P pc [ra ...]" line of hex per sample between "PROF-BEGIN" and
+ * "PROF-END" lines.
+ * Parameters: None
+ * Returns: None
+ */
+void prof_dump(void);
+
+#endif // PROF_H
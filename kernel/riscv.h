@@ -166,6 +166,7 @@ w_mideleg(uint64 x)
 
 // Supervisor Trap-Vector Base Address
 // low two bits are mode.
+#define STVEC_VECTORED 1  // interrupt n enters at base + 4*n
 static inline void 
 w_stvec(uint64 x)
 {
@@ -236,6 +237,18 @@ r_scause()
   return x;
 }
 
+// scause values for the interrupts the kernel expects.
+#define SCAUSE_INTR (1L << 63)           // set for interrupts, clear for exceptions
+#define SCAUSE_SSI  (SCAUSE_INTR | 1)    // supervisor software (timer tick)
+#define SCAUSE_STI  (SCAUSE_INTR | 5)    // supervisor timer
+#define SCAUSE_SEI  (SCAUSE_INTR | 9)    // supervisor external (PLIC)
+
+static inline void
+w_scause(uint64 x)
+{
+  asm volatile("csrw scause, %0" : : "r" (x));
+}
+
 // Supervisor Trap Value
 static inline uint64
 r_stval()
@@ -246,6 +259,9 @@ r_stval()
 }
 
 // Machine-mode Counter-Enable
+#define MCOUNTEREN_CY (1L << 0) // supervisor may read cycle
+#define MCOUNTEREN_TM (1L << 1) // supervisor may read time
+#define MCOUNTEREN_IR (1L << 2) // supervisor may read instret
 static inline void 
 w_mcounteren(uint64 x)
 {
@@ -260,6 +276,27 @@ r_mcounteren()
   return x;
 }
 
+// Machine Environment Configuration (0x30a), from privileged
+// spec 1.12; older CPUs fault on it. STCE lets the supervisor own
+// its timer through stimecmp (the Sstc extension).
+#define MENVCFG_STCE (1L << 63)
+
+// Supervisor Timer Compare (0x14d, Sstc): a supervisor timer
+// interrupt is pending while time >= stimecmp.
+static inline void
+w_stimecmp(uint64 x)
+{
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
+static inline uint64
+r_stimecmp()
+{
+  uint64 x;
+  asm volatile("csrr %0, 0x14d" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -269,6 +306,16 @@ r_time()
   return x;
 }
 
+// cycle counter; supervisor mode may read it
+// once start() has set MCOUNTEREN_CY.
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
 // enable device interrupts
 static inline void
 intr_on()
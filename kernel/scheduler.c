@@ -0,0 +1,386 @@
+//
+// per-hart process scheduler.
+//
+// Each hart has a run queue: a FIFO of RUNNABLE processes, linked
+// through runnext[] since struct proc is fixed by the precompiled
+// code. Picking the next process and putting one back are O(1). A
+// hart whose queue is empty steals the oldest process from the
+// hart with the longest queue before it goes idle.
+//
+// An idle hart sleeps in timer_idle, with its tick stopped. Whoever
+// queues work, by waking a process that slept in sys_port_read or
+// by yielding one while others wait, kicks a sleeping hart awake
+// with an IPI: the hart the process last ran on, or one that can
+// steal it.
+//
+// The precompiled trap and syscall code was written for one hart: it
+// finds the current process in the global cpu, and keeps no locks.
+// So kernel code runs for at most one process at a time, under
+// biglock. A hart takes it to run a process, in scheduler() or in
+// userenter() on a trap from user space, and lets it go in userexit()
+// on the way back to user space. Processes run in user mode on every
+// hart at once; only their time in the kernel is serialized.
+//
+// lock order: biglock, then one runq lock at a time.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "proc.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "ktime.h"
+#include "console.h"
+#include "disk.h"
+#include "port.h"
+#include "ipi.h"
+#include "timer.h"
+#include "trap.h"
+
+void swtch(struct context *old, struct context *new);
+void usertrap(void);
+
+struct spinlock biglock;
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;
+  volatile int idle;        // the hart is, or is about to be, in wfi
+  struct schedstats stats;  // updated by the owning hart
+};
+
+static struct runq runqs[NCPU];
+static struct proc *runnext[NPROC];
+static int queued[NPROC];    // on some run queue; claimed atomically
+static int lasthart[NPROC];  // where each process last ran
+static uint64 wakeat[NPROC]; // mtime of sched_wakeup, until it runs
+
+// the process sys_clone has just allocated, which it makes RUNNABLE
+// before returning. guarded by biglock.
+static struct proc *newborn;
+
+
+void
+sched_init(void)
+{
+  initlock(&biglock, "big");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+}
+
+
+// Append p to rq, unless it is on a queue already.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  int i = p - proc;
+
+  if(__sync_lock_test_and_set(&queued[i], 1))
+    return;
+  acquire(&rq->lock);
+  runnext[i] = 0;
+  if(rq->tail)
+    runnext[rq->tail - proc] = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+
+// Take the process at the head of rq, or return 0.
+static struct proc*
+dequeue(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = runnext[p - proc];
+    if(rq->head == 0)
+      rq->tail = 0;
+    rq->n--;
+    // clear the claim before the caller looks at p->state, so a
+    // waker that finds it still set has already made p RUNNABLE.
+    __sync_lock_release(&queued[p - proc]);
+  }
+  release(&rq->lock);
+  return p;
+}
+
+
+// Work was queued on hart h: wake h if it sleeps, or else, if h has
+// more queued than the keep it will get to itself, a sleeping hart
+// that can steal the rest.
+static void
+kick(int h, int keep)
+{
+  if(runqs[h].idle){
+    ipi_send(h);
+    return;
+  }
+  if(runqs[h].n <= keep)
+    return;
+  for(int i = 1; i < NCPU; i++){
+    int o = (h + i) % NCPU;
+    if(runqs[o].idle){
+      ipi_send(o);
+      return;
+    }
+  }
+}
+
+
+// Is any process queued anywhere?
+static int
+anywork(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    if(runqs[i].n)
+      return 1;
+  }
+  return 0;
+}
+
+
+// Take a process from the hart with the most queued, if any.
+static struct proc*
+steal(int self)
+{
+  int best = -1, most = 0;
+  struct proc *p;
+
+  for(int i = 1; i < NCPU; i++){
+    int h = (self + i) % NCPU;
+    int n = runqs[h].n;  // a hint; dequeue rechecks under the lock
+    if(n > most){
+      most = n;
+      best = h;
+    }
+  }
+  if(best < 0)
+    return 0;
+  p = dequeue(&runqs[best]);
+  if(p)
+    runqs[self].stats.steals++;
+  return p;
+}
+
+
+// Put RUNNABLE processes no queue knows about on self's queue:
+// proc_load_user_init and other precompiled code set RUNNABLE
+// directly. Only done when every queue is empty, so it costs
+// nothing while there is work.
+static void
+adopt(int self)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    if(p->state == RUNNABLE && !queued[p - proc])
+      enqueue(&runqs[self], p);
+  }
+}
+
+
+// Queue the process sys_clone made, once it is RUNNABLE; it never
+// will be if the clone failed. Called with biglock held.
+static void
+queue_newborn(int self)
+{
+  if(newborn && newborn->state == RUNNABLE){
+    enqueue(&runqs[self], newborn);
+    kick(self, 0);
+  }
+  newborn = 0;
+}
+
+
+// The next process for this hart to run, with biglock held, so no
+// process is half way between states. A process freed or not yet
+// started since it was queued is dropped; whoever makes it RUNNABLE
+// again queues it.
+static struct proc*
+pick(int self)
+{
+  struct proc *p;
+
+  for(;;){
+    p = dequeue(&runqs[self]);
+    if(p == 0)
+      p = steal(self);
+    if(p == 0){
+      adopt(self);
+      p = dequeue(&runqs[self]);
+    }
+    if(p == 0 || p->state == RUNNABLE)
+      return p;
+  }
+}
+
+
+static void
+waited(struct schedstats *st, uint64 t)
+{
+  st->wakeups++;
+  st->wake_lat += t;
+  if(t > st->wake_lat_max)
+    st->wake_lat_max = t;
+}
+
+
+void
+scheduler(void)
+{
+  int self = cpuid();
+  struct cpu *c = mycpu();
+  struct runq *rq = &runqs[self];
+  struct proc *p;
+
+  c->proc = 0;
+  rq->stats.start = r_time();
+  for(;;){
+    // biglock keeps interrupts off until the process it passes to
+    // lets it go in userexit.
+    intr_off();
+    acquire(&biglock);
+    p = pick(self);
+    if(p == 0){
+      release(&biglock);
+      rq->stats.idles++;
+      // raise the flag before the last look, so that a hart
+      // queueing work after it sees the flag and kicks us.
+      rq->idle = 1;
+      __sync_synchronize();
+      if(!anywork())
+        timer_idle();
+      rq->idle = 0;
+      intr_on();
+      continue;
+    }
+
+    p->state = RUNNING;
+    c->proc = p;
+    cpu.proc = p;
+    lasthart[p - proc] = self;
+    rq->stats.switches++;
+    if(wakeat[p - proc]){
+      waited(&rq->stats, r_time() - wakeat[p - proc]);
+      wakeat[p - proc] = 0;
+    }
+    swtch(&c->context, &p->context);
+
+    // p is off its stack now, so another hart may take it.
+    c->proc = 0;
+    queue_newborn(self);
+    if(p->state == RUNNABLE){
+      enqueue(rq, p);
+      kick(self, 1);
+    }
+    release(&biglock);
+  }
+}
+
+
+void
+yield(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p = c->proc;
+
+  // kerneltrap yields cpu.proc on a tick, which on another hart
+  // than the one running it is not ours to give up.
+  if(p == 0)
+    return;
+  // in sys_port_read, with nothing to read yet, sleep until a
+  // port_write instead of coming straight back.
+  if(p->state == RUNNING && !port_wait(p))
+    p->state = RUNNABLE;
+  uartstart();
+  virtio_disk_start();
+  swtch(&p->context, &c->context);
+}
+
+
+void
+sched_newproc(struct proc *p)
+{
+  newborn = p;
+}
+
+
+void
+sched_wakeup(struct proc *p)
+{
+  int h = lasthart[p - proc];
+
+  wakeat[p - proc] = r_time();
+  enqueue(&runqs[h], p);
+  kick(h, 0);
+}
+
+
+// uservec jumps here, on the process's kernel stack, in place of
+// usertrap.
+void
+userenter(void)
+{
+  // usertrap would leave stvec on uservec, and a kernel trap taken
+  // there would be taken for a user one.
+  ktrapvec(1);
+  acquire(&biglock);
+  cpu.proc = mycpu()->proc;
+  ktrap_user();
+  usertrap();
+}
+
+
+// userret calls this on the way out to user space.
+void
+userexit(void)
+{
+  struct proc *p = mycpu()->proc;
+
+  // a read that found nothing, then returned what it had read.
+  if(p->wait_read)
+    port_unwait(p);
+  queue_newborn(cpuid());
+  release(&biglock);
+}
+
+
+void
+sched_getstats(int hart, struct schedstats *st)
+{
+  *st = runqs[hart].stats;
+  st->queued = runqs[hart].n;
+}
+
+
+void
+sched_stats(void)
+{
+  struct schedstats st;
+  uint64 us;
+
+  for(int i = 0; i < NCPU; i++){
+    sched_getstats(i, &st);
+    if(st.start == 0)
+      continue;
+    us = mtime_to_us(r_time() - st.start);
+    printf("sched hart %d: %lu switches (%lu/s), %lu steals, "
+           "%lu idles, %d queued\n", i, st.switches,
+           us ? st.switches * 1000000 / us : 0, st.steals, st.idles,
+           st.queued);
+    if(st.wakeups)
+      printf("sched hart %d: %lu wakeups, wakeup to run %luus avg, "
+             "%luus max\n", i, st.wakeups,
+             mtime_to_us(st.wake_lat / st.wakeups),
+             mtime_to_us(st.wake_lat_max));
+  }
+}
@@ -1,12 +1,34 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
+#include "types.h"
+#include "spinlock.h"
+
+struct proc;
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this hart's run queue, or
+//    failing that, from the busiest other hart's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
-//    via swtch back to the scheduler.
+//    via swtch back to the scheduler, which puts it back on the
+//    queue if it is still RUNNABLE.
+
+// held by the hart running kernel code on behalf of a process
+// (scheduler.c).
+extern struct spinlock biglock;
+
+/*
+ * Set up the big lock and the run queue locks. Called once, before
+ * any hart enters scheduler().
+ * Parameters:
+ *   - None
+ * Returns:
+ *   - None
+ */
+void sched_init(void);
+
 /*
  * Run the scheduler.
  * This function is called by each CPU after setting itself up.
@@ -21,11 +43,65 @@ void scheduler(void);
 // Give up the CPU for one scheduling round.
 /*
  * Yield the CPU.
- * Give up the CPU for one scheduling round.
+ * Give up the CPU for one scheduling round: the process goes to the
+ * tail of this hart's run queue. Does nothing on a hart that is not
+ * running a process.
  * Parameters:
  *   - None
  * Returns:
  *   - None
  */
 void yield(void);
-#endif
\ No newline at end of file
+
+/*
+ * Note a process just handed out by proc_alloc. It is queued once
+ * its creator has made it RUNNABLE. Called with biglock held.
+ * Parameters:
+ *   - p: The new process.
+ * Returns:
+ *   - None
+ */
+void sched_newproc(struct proc *p);
+
+/*
+ * Queue a process that has just been made RUNNABLE, on the hart it
+ * last ran on, and kick a sleeping hart with an IPI to run it.
+ * Parameters:
+ *   - p: The process, already RUNNABLE.
+ * Returns:
+ *   - None
+ */
+void sched_wakeup(struct proc *p);
+
+// scheduler counters for one hart, since it entered scheduler().
+struct schedstats {
+  uint64 start;     // mtime at which it entered scheduler()
+  uint64 switches;  // switches into a process
+  uint64 steals;    // processes taken from another hart's queue
+  uint64 idles;     // times it found no work and waited
+  uint64 wakeups;   // processes it ran after sched_wakeup
+  uint64 wake_lat;  // mtime ticks from sched_wakeup to running, in total
+  uint64 wake_lat_max;
+  int queued;       // processes on its run queue now
+};
+
+/*
+ * Copy out a hart's scheduler counters.
+ * Parameters:
+ *   - hart: The hart.
+ *   - st: Where to store them.
+ * Returns:
+ *   - None
+ */
+void sched_getstats(int hart, struct schedstats *st);
+
+/*
+ * Print each running hart's scheduler counters, its context switch
+ * rate, and its wakeup-to-run latency.
+ * Parameters:
+ *   - None
+ * Returns:
+ *   - None
+ */
+void sched_stats(void);
+#endif
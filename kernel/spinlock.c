@@ -0,0 +1,117 @@
+//
+// spinlocks, and interrupt disabling that nests.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "console.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NLOCK 64  // locks lock_stats can list
+
+static struct spinlock *locks[NLOCK];
+static int nlock;
+
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  int i;
+
+  lk->name = name;
+  lk->cpu = -1;
+
+  // harts initialize their own locks as they come up.
+  i = __sync_fetch_and_add(&nlock, 1);
+  if(i < NLOCK)
+    locks[i] = lk;
+}
+
+
+void
+acquire(struct spinlock *lk)
+{
+  uint64 n = 0;
+
+  push_off();
+  if(holding(lk))
+    panic("acquire");
+
+  // amoswap.w.aq; the acquire ordering keeps the critical
+  // section's loads and stores after it.
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    n++;
+  __sync_synchronize();
+
+  lk->cpu = cpuid();
+  lk->acquires++;
+  if(n){
+    lk->contended++;
+    lk->spins += n;
+  }
+}
+
+
+void
+release(struct spinlock *lk)
+{
+  if(!holding(lk))
+    panic("release");
+
+  lk->cpu = -1;
+  __sync_synchronize();
+  __sync_lock_release(&lk->locked);
+  pop_off();
+}
+
+
+int
+holding(struct spinlock *lk)
+{
+  return lk->locked && lk->cpu == cpuid();
+}
+
+
+void
+lock_stats(void)
+{
+  struct spinlock *lk;
+  int n = nlock < NLOCK ? nlock : NLOCK;
+
+  for(int i = 0; i < n; i++){
+    lk = locks[i];
+    printf("lock %s: %lu acquires, %lu contended, %lu spins\n",
+           lk->name, lk->acquires, lk->contended, lk->spins);
+  }
+}
+
+
+void
+push_off(void)
+{
+  int old = intr_get();
+  struct cpu *c;
+
+  intr_off();
+  c = mycpu();
+  if(c->noff == 0)
+    c->intena = old;
+  c->noff++;
+}
+
+
+void
+pop_off(void)
+{
+  struct cpu *c = mycpu();
+
+  if(intr_get())
+    panic("pop_off - interruptible");
+  if(c->noff < 1)
+    panic("pop_off");
+  c->noff--;
+  if(c->noff == 0 && c->intena)
+    intr_on();
+}
@@ -0,0 +1,75 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "types.h"
+
+// Mutual exclusion lock. Holding one keeps interrupts off on the
+// holding hart. The counters are updated by the holder, so reading
+// them needs no further locking.
+struct spinlock {
+  uint locked;       // is the lock held?
+  char *name;        // for lock_stats
+  int cpu;           // hart holding the lock
+  uint64 acquires;   // times acquired
+  uint64 contended;  // acquires that found the lock held
+  uint64 spins;      // passes around the wait loop, in total
+};
+
+/*
+ * Name a lock and list it in lock_stats. A zeroed lock already
+ * works; initlock only has to run before lock_stats.
+ * Parameters:
+ *  - lk: The lock.
+ *  - name: Its name, for lock_stats.
+ * Returns: None
+ */
+void initlock(struct spinlock *lk, char *name);
+
+/*
+ * Acquire the lock, spinning until it is free. Interrupts stay off
+ * on this hart until the matching release. Panics if this hart
+ * already holds it.
+ * Parameters:
+ *  - lk: The lock.
+ * Returns: None
+ */
+void acquire(struct spinlock *lk);
+
+/*
+ * Release the lock.
+ * Parameters:
+ *  - lk: The lock, held by this hart.
+ * Returns: None
+ */
+void release(struct spinlock *lk);
+
+/*
+ * Returns: Non-zero if this hart holds lk. Call with interrupts off.
+ */
+int holding(struct spinlock *lk);
+
+/*
+ * Print the counters of every lock passed to initlock.
+ * Parameters: None
+ * Returns: None
+ */
+void lock_stats(void);
+
+/*
+ * Disable interrupts on this hart, remembering whether they were on.
+ * push_off/pop_off pairs nest: interrupts come back on at the last
+ * pop_off, and only if they were on at the first push_off.
+ * Parameters: None
+ * Returns: None
+ */
+void push_off(void);
+
+/*
+ * Undo one push_off. Panics if interrupts are on or there was no
+ * matching push_off.
+ * Parameters: None
+ * Returns: None
+ */
+void pop_off(void);
+
+#endif // SPINLOCK_H
@@ -1,23 +1,63 @@
 #include "types.h"
+#include "param.h"
 #include "riscv.h"
 #include "memlayout.h"
+#include "timer.h"
 
 void main();
 void timerinit();
 
 
-// entry.S needs a stack.
-__attribute__ ((aligned (16))) char stack0[4096*2];
-uint64 timer_scratch[5];
+// entry.S needs a stack, one per hart.
+__attribute__ ((aligned (16))) char stack0[4096 * NCPU];
+
+// timervec's save area and parameters, one per hart.
+uint64 timer_scratch[NCPU][7];
+
+// mtime when hart 0 came out of reset, for main's boot report.
+uint64 boot_start;
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+// kernelvec.S: skips an instruction that faulted in machine mode.
+extern void mprobevec();
+
+// set by start() when the supervisor programs its own timer
+// through Sstc's stimecmp; timervec then only carries IPIs.
+int has_sstc;
+
+
+// Does the CPU have Sstc? Try to set menvcfg.STCE and see if it
+// sticks. Must run before mstatus.MPP is set up for main, since
+// a fault taken here writes MPP.
+static int
+probe_sstc(void)
+{
+  uint64 x = 0;
+
+  // a CPU without menvcfg faults on these; mprobevec skips them
+  // and x stays 0.
+  w_mtvec((uint64)mprobevec);
+  asm volatile("csrs 0x30a, %0" : : "r" (MENVCFG_STCE));
+  asm volatile("csrr %0, 0x30a" : "+r" (x));
+  return (x & MENVCFG_STCE) != 0;
+}
+
 
 // entry.S jumps here in machine mode on stack0.
 void
 start()
 {
+  // paging is off and this is machine mode, so the CLINT can be
+  // read directly.
+  if(r_mhartid() == 0)
+    boot_start = *(uint64*)CLINT_MTIME;
+
+#ifdef SSTC
+  has_sstc = probe_sstc();
+#endif
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -41,6 +81,10 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor mode read the cycle and time counters,
+  // for benchmarks and timestamps.
+  w_mcounteren(r_mcounteren() | MCOUNTEREN_CY | MCOUNTEREN_TM | MCOUNTEREN_IR);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -65,17 +109,26 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 100000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  int interval = TICK_INTERVAL; // mtime ticks; 10ms.
+
+  // with Sstc the supervisor timer interrupt comes straight from
+  // stimecmp, and the kernel timers program it from here on.
+  // otherwise ask the CLINT for a timer interrupt.
+  if(has_sstc)
+    w_stimecmp(*(uint64*)CLINT_MTIME + interval);
+  else
+    *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
-  uint64 *scratch = &timer_scratch[0];
+  // scratch[4] : desired interval (in mtime ticks) between timer interrupts.
+  // scratch[5] : address of CLINT MSIP register, for IPIs.
+  // scratch[6] : set when the interrupt timervec raised is a tick.
+  uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[5] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +137,9 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and the software
+  // interrupts that carry IPIs (ipi.c).
+  if(!has_sstc)
+    w_mie(r_mie() | MIE_MTIE);
+  w_mie(r_mie() | MIE_MSIE);
 }
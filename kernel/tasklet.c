@@ -0,0 +1,137 @@
+//
+// deferred work (tasklets) for interrupt handlers.
+//
+// one run list serves every hart: a tasklet runs on whichever hart
+// next calls tasklet_run, usually the one whose handler scheduled
+// it. tasklock guards the list and the tasklets' flags; the tasklets
+// themselves run with it released and interrupts on, unless the hart
+// holds some other lock. tasklet_run is the only one to take
+// tasklets off the list. Harts may run tasklets at the same time,
+// but never the same one.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "proc.h"
+#include "tasklet.h"
+#include "spinlock.h"
+
+static struct spinlock tasklock;
+static struct tasklet *head;
+static struct tasklet **tail = &head;
+static int running[NCPU];  // a tasklet_run is in progress on the hart
+
+
+void
+tasklet_init(void)
+{
+  initlock(&tasklock, "tasklet");
+}
+
+
+static void
+enqueue(struct tasklet *t)
+{
+  t->queued = 1;
+  t->next = 0;
+  *tail = t;
+  tail = &t->next;
+}
+
+
+void
+tasklet_schedule(struct tasklet *t)
+{
+  acquire(&tasklock);
+  if(!t->queued)
+    enqueue(t);
+  release(&tasklock);
+}
+
+
+void
+tasklet_disable(struct tasklet *t)
+{
+  acquire(&tasklock);
+  t->disabled++;
+  release(&tasklock);
+}
+
+
+void
+tasklet_enable(struct tasklet *t)
+{
+  int run;
+
+  acquire(&tasklock);
+  run = --t->disabled == 0 && t->queued;
+  release(&tasklock);
+  if(run && intr_get())
+    tasklet_run();
+}
+
+
+int
+tasklet_pending(void)
+{
+  return head != 0;
+}
+
+
+void
+tasklet_run(void)
+{
+  int on = intr_get();
+  struct tasklet *t, *held, **heldtail;
+  int self;
+
+  acquire(&tasklock);
+  self = cpuid();
+  // a trap taken while a tasklet runs here comes back through here.
+  if(running[self]){
+    release(&tasklock);
+    return;
+  }
+  running[self] = 1;
+
+  // disabled tasklets, and ones another hart is running, stay
+  // queued, in order, for a later run.
+  held = 0;
+  heldtail = &held;
+  while((t = head) != 0){
+    head = t->next;
+    if(head == 0)
+      tail = &head;
+
+    if(t->disabled || t->running){
+      t->next = 0;
+      *heldtail = t;
+      heldtail = &t->next;
+      continue;
+    }
+    t->queued = 0;
+    t->running = 1;
+
+    release(&tasklock);
+    // with a lock held, as biglock is in userenter, a tick taken in
+    // the tasklet could yield the hart away from under it.
+    if(mycpu()->noff == 0)
+      intr_on();
+    t->fn(t);
+    intr_off();
+    acquire(&tasklock);
+    t->running = 0;
+  }
+  if(held){
+    *heldtail = head;
+    if(head == 0)
+      tail = heldtail;
+    head = held;
+  }
+
+  running[self] = 0;
+  release(&tasklock);
+  if(on)
+    intr_on();
+}
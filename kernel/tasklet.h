@@ -0,0 +1,72 @@
+#ifndef TASKLET_H
+#define TASKLET_H
+
+#include "types.h"
+
+// Deferred work for interrupt handlers. A handler does the minimum
+// with interrupts off (read the device, acknowledge it) and schedules
+// a tasklet for the rest; the tasklet runs once the handlers return,
+// with interrupts on unless the hart holds a lock, so other devices
+// and the timer are not held off behind it.
+struct tasklet {
+  struct tasklet *next;
+  int queued;                    // on the run list
+  int disabled;                  // tasklet_disable depth; held back while > 0
+  int running;                   // fn is running, on some hart
+  void (*fn)(struct tasklet *);  // the deferred work
+  void *arg;
+};
+
+/*
+ * Initialize the tasklet list's lock. Called once, at boot.
+ * Parameters: None
+ * Returns: None
+ */
+void tasklet_init(void);
+
+/*
+ * Queue a tasklet to run after the current trap's handlers. Safe to
+ * call from handlers and with interrupts on or off. A tasklet queued
+ * again before it runs runs once.
+ * Parameters:
+ *  - t: The tasklet; t->fn must be set.
+ * Returns: None
+ */
+void tasklet_schedule(struct tasklet *t);
+
+/*
+ * Run queued tasklets, in the order they were queued, until none are
+ * left: with interrupts on, unless the calling hart holds a spinlock.
+ * ktrap calls this on the way out of a trap; a trap taken while
+ * tasklets run on this hart does not run them again there. A tasklet
+ * another hart is running is left queued for a later run.
+ * Parameters: None
+ * Returns: None
+ */
+void tasklet_run(void);
+
+/*
+ * Hold a tasklet back: it may still be queued, but does not run until
+ * the matching tasklet_enable. Pairs nest. Code that shares data with
+ * a tasklet uses these to keep it out without turning off interrupts.
+ * Parameters:
+ *  - t: The tasklet.
+ * Returns: None
+ */
+void tasklet_disable(struct tasklet *t);
+
+/*
+ * Undo one tasklet_disable. If that lets a queued tasklet run and
+ * interrupts are on, it runs before tasklet_enable returns.
+ * Parameters:
+ *  - t: The tasklet.
+ * Returns: None
+ */
+void tasklet_enable(struct tasklet *t);
+
+/*
+ * Returns: Non-zero if any tasklet is queued.
+ */
+int tasklet_pending(void);
+
+#endif // TASKLET_H
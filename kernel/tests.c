@@ -4,6 +4,14 @@
 #include "tests.h"
 #include "string.h"
 #include "riscv.h"
+#include "memlayout.h"
+#include "timer.h"
+#include "ktime.h"
+#include "trap.h"
+#include "param.h"
+#include "scheduler.h"
+#include "ipi.h"
+#include "proc.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Unit Tests in this line should not be changed. You may study them to see
@@ -254,3 +262,669 @@ port_test(void)
     print_pass(passed);
     
 }
+
+
+// A process whose kernel code only read empty ports of its own
+// accord, as uartstart and virtio_disk_start do on the way through
+// yield, must stay runnable: only sys_port_read's reads may sleep.
+// Runs on hart 0, which never runs processes, with a free proc slot
+// standing in as the current process.
+void
+test_port_wait(void)
+{
+    struct cpu *c;
+    struct proc *p;
+    char ch;
+    int passed;
+
+    printf("port wait test...");
+    uartflush();
+    for(p = proc; p < &proc[NPROC] && p->state != UNUSED; p++)
+        ;
+    if(p == &proc[NPROC]) {
+        print_pass(0);
+        return;
+    }
+
+    // no tick may yield the stand-in.
+    push_off();
+    c = mycpu();
+    c->proc = p;
+    passed = port_read(PORT_DISKCMD, &ch, 1) == 0;
+    uartstart();
+    virtio_disk_start();
+    passed = passed && p->wait_read == 0 && !port_wait(p);
+    // undo a failure's wait, for whoever gets the slot next.
+    port_unwait(p);
+    p->state = UNUSED;
+    c->proc = 0;
+    pop_off();
+    print_pass(passed);
+}
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Benchmarks (make qemu BENCH=1)
+// Each result is one line: "BENCH <suite> key=value ...".
+//////////////////////////////////////////////////////////////////////
+
+#define BENCH_ITERS 1000
+
+// The printint printf used before the two-digit conversion tables:
+// one divide by a variable base per digit, and one port_write per
+// character. Kept here as the baseline for bench_printint.
+static void
+legacy_printint(int port, int xx, int base, int sign)
+{
+  static char digits[] = "0123456789abcdef";
+  char buf[16];
+  int i;
+  uint x;
+
+  if(sign && (sign = xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    buf[i++] = '-';
+
+  while(--i >= 0)
+    port_write(port, buf + i, 1);
+}
+
+
+// a cheap pseudo-random sequence with a spread of digit counts.
+static uint
+bench_rand(uint *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> (*state & 0x1f);
+}
+
+
+// Compare cycles per formatted number between the legacy printint
+// loop and the current printf conversions.
+void
+bench_printint(void)
+{
+  char buf[PORT_BUF_SIZE];
+  static int bases[] = {10, 16};
+  uint64 legacy, fast, wide, t;
+  uint seed;
+  int port;
+  int base;
+  int v;
+
+  port = port_acquire(-1, 0);
+
+  for(int b = 0; b < 2; b++) {
+    base = bases[b];
+    legacy = fast = wide = 0;
+    seed = 1;
+    for(int i = 0; i < BENCH_ITERS; i++) {
+      v = bench_rand(&seed);
+
+      t = r_cycle();
+      legacy_printint(port, v, base, base == 10);
+      legacy += r_cycle() - t;
+      port_read(port, buf, PORT_BUF_SIZE);
+
+      t = r_cycle();
+      pprintf(port, base == 10 ? "%d" : "%x", v);
+      fast += r_cycle() - t;
+      port_read(port, buf, PORT_BUF_SIZE);
+
+      t = r_cycle();
+      pprintf(port, base == 10 ? "%ld" : "%lx", (uint64)v * v);
+      wide += r_cycle() - t;
+      port_read(port, buf, PORT_BUF_SIZE);
+    }
+
+    printf("BENCH printint impl=legacy base=%d cycles_per_num=%lu\n",
+           base, legacy / BENCH_ITERS);
+    printf("BENCH printint impl=fast base=%d cycles_per_num=%lu\n",
+           base, fast / BENCH_ITERS);
+    printf("BENCH printint impl=fast64 base=%d cycles_per_num=%lu\n",
+           base, wide / BENCH_ITERS);
+    uartflush();
+  }
+
+  port_close(port);
+}
+
+
+#define BENCH_UART_MAX 1000
+
+// Send size bytes from buf through PORT_CONSOLEOUT and return
+// the elapsed time in timer ticks. burst == 0 means polled
+// output through uartflush; otherwise the interrupt driven
+// path, refilling the TX FIFO burst bytes at a time.
+static uint64
+bench_uart_send(char *buf, int size, int burst)
+{
+  uint64 t;
+  int sent, n;
+
+  uartsetburst(burst ? burst : 16);
+  t = r_time();
+  for(sent = 0; sent < size; sent += n) {
+    n = port_write(PORT_CONSOLEOUT, buf + sent, size - sent);
+    if(burst == 0) {
+      uartflush();
+    } else {
+      intr_off();
+      uartstart();
+      intr_on();
+    }
+  }
+  while(ports[PORT_CONSOLEOUT].count)
+    ;
+  // up to a FIFO's worth is still on its way out.
+  uartdrain();
+  t = r_time() - t;
+  intr_off();
+  return t;
+}
+
+
+// Measure UART output throughput, interrupt rate and driver
+// cost for polled, byte-at-a-time and FIFO-burst output across
+// line speeds and message sizes. QEMU's 16550 ignores the divisor
+// and sends as fast as the chardev takes bytes, so there the baud
+// rows differ only in driver behaviour, not in line rate.
+void
+bench_uart(void)
+{
+  static char buf[BENCH_UART_MAX];
+  static char *modes[] = {"poll", "intr1", "fifo"};
+  static int bursts[] = {0, 1, 16};
+  static int bauds[] = {9600, 38400, 115200};
+  static int sizes[] = {64, 256, BENCH_UART_MAX};
+  struct uartstats before, after;
+  uint64 t;
+
+  // printable lines, so the benchmark output stays readable.
+  for(int i = 0; i < BENCH_UART_MAX; i++)
+    buf[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+
+  printf("BENCH uart note=qemu_ignores_divisor baud_rows_not_line_rate=1\n");
+  uartflush();
+  intr_off();
+  for(int b = 0; b < 3; b++) {
+    uartsetbaud(bauds[b]);
+    for(int m = 0; m < 3; m++) {
+      for(int s = 0; s < 3; s++) {
+        uartgetstats(&before);
+        t = bench_uart_send(buf, sizes[s], bursts[m]);
+        uartgetstats(&after);
+
+        // report at a fixed speed, outside the measured window.
+        uartsetbaud(38400);
+        printf("\nBENCH uart mode=%s baud=%d size=%d bytes_per_sec=%lu "
+               "intr_per_kb=%lu cycles=%lu\n",
+               modes[m], bauds[b], sizes[s],
+               sizes[s] * CLINT_MTIME_HZ / (t ? t : 1),
+               (after.intr - before.intr) * 1024 / sizes[s],
+               after.cycles - before.cycles);
+        uartflush();
+        uartsetbaud(bauds[b]);
+      }
+    }
+  }
+
+  uartsetbaud(38400);
+  uartsetburst(16);
+}
+
+
+#define BENCH_PORT_ITERS 200
+
+// Cycles for one write of n bytes followed by one read of n bytes,
+// averaged over BENCH_PORT_ITERS rounds. The port is left empty
+// with its head and tail wherever the last round put them.
+static void
+bench_port_rw(int port, char *buf, int n, uint64 *wr, uint64 *rd)
+{
+  uint64 t;
+
+  *wr = *rd = 0;
+  for(int i = 0; i < BENCH_PORT_ITERS; i++) {
+    t = r_cycle();
+    port_write(port, buf, n);
+    *wr += r_cycle() - t;
+
+    t = r_cycle();
+    port_read(port, buf, n);
+    *rd += r_cycle() - t;
+  }
+  *wr /= BENCH_PORT_ITERS;
+  *rd /= BENCH_PORT_ITERS;
+}
+
+
+// Measure the cost of the port operations everything else is
+// built on: reads and writes by chunk size, copies that wrap
+// around the ring, acquire/close pairs, and a one byte exchange
+// between two ports.
+void
+bench_ports(void)
+{
+  static char buf[PORT_BUF_SIZE];
+  static int chunks[] = {1, 8, 64, 256, PORT_BUF_SIZE};
+  uint64 wr, rd, t;
+  int a, b;
+  char c;
+
+  a = port_acquire(-1, 0);
+  b = port_acquire(-1, 0);
+
+  // head and tail at 0, and chunks dividing the buffer size, so
+  // no copy has to wrap.
+  for(int i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++) {
+    bench_port_rw(a, buf, chunks[i], &wr, &rd);
+    printf("BENCH ports op=rw pattern=linear chunk=%d write_cycles=%lu "
+           "read_cycles=%lu cycles_per_byte=%lu\n",
+           chunks[i], wr, rd, (wr + rd) / chunks[i]);
+    uartflush();
+  }
+
+  // one byte short of the buffer size moves the tail back one
+  // each round, so nearly every copy is split in two.
+  bench_port_rw(a, buf, PORT_BUF_SIZE - 1, &wr, &rd);
+  printf("BENCH ports op=rw pattern=wrap chunk=%d write_cycles=%lu "
+         "read_cycles=%lu cycles_per_byte=%lu\n",
+         PORT_BUF_SIZE - 1, wr, rd, (wr + rd) / (PORT_BUF_SIZE - 1));
+  uartflush();
+
+  port_close(b);
+  port_close(a);
+
+  t = r_cycle();
+  for(int i = 0; i < BENCH_PORT_ITERS; i++)
+    port_close(port_acquire(-1, 0));
+  t = r_cycle() - t;
+  printf("BENCH ports op=acquire_close cycles_per_pair=%lu\n",
+         t / BENCH_PORT_ITERS);
+  uartflush();
+
+  // there is only one thread of control, so a round trip is the
+  // four operations back to back: a message on a, its reply on b.
+  a = port_acquire(-1, 0);
+  b = port_acquire(-1, 0);
+  c = 'x';
+  t = r_cycle();
+  for(int i = 0; i < BENCH_PORT_ITERS; i++) {
+    port_write(a, &c, 1);
+    port_read(a, &c, 1);
+    port_write(b, &c, 1);
+    port_read(b, &c, 1);
+  }
+  t = r_cycle() - t;
+  printf("BENCH ports op=pingpong cycles_per_roundtrip=%lu\n",
+         t / BENCH_PORT_ITERS);
+  uartflush();
+  port_close(b);
+  port_close(a);
+}
+
+
+#define STRESS_LINE_MAX 256
+
+// Serve utils/stress.py: read lines from PORT_CONSOLEIN with echo
+// off and answer each one, so the host can check that every byte
+// it sent arrived intact and in order. A line starting with 'E'
+// is sent back whole as "ECHO <line>"; any other line is answered
+// with its length and FNV-1a hash. "QUIT" ends the run with the
+// driver's counters.
+void
+stress_console(void)
+{
+  char line[STRESS_LINE_MAX];
+  char buf[64];
+  struct uartstats st;
+  uint32 hash;
+  int i, n, len;
+
+  uartecho(0);
+  intr_on();
+  printf("STRESS-READY\n");
+
+  len = 0;
+  hash = 2166136261;
+  for(;;) {
+    uartmask();
+    n = port_read(PORT_CONSOLEIN, buf, sizeof(buf));
+    uartunmask();
+    if(n <= 0) {
+      // check again with interrupts off, so input that arrives
+      // in between still ends the wfi.
+      intr_off();
+      if(ports[PORT_CONSOLEIN].count == 0)
+        timer_idle();
+      intr_on();
+    }
+    for(i = 0; i < n; i++) {
+      if(buf[i] != '\n') {
+        hash = (hash ^ (uchar)buf[i]) * 16777619;
+        if(len < STRESS_LINE_MAX)
+          line[len] = buf[i];
+        len++;
+        continue;
+      }
+
+      if(len == 4 && strncmp(line, "QUIT", 4) == 0)
+        goto done;
+
+      // printf drops what does not fit in PORT_CONSOLEOUT, so
+      // wait for room; the host sees this as back pressure.
+      while(ports[PORT_CONSOLEOUT].count > PORT_BUF_SIZE - STRESS_LINE_MAX - 32)
+        ;
+      if(len > 0 && line[0] == 'E' && len < STRESS_LINE_MAX) {
+        line[len] = '\0';
+        printf("ECHO %s\n", line);
+      } else {
+        printf("STRESS n=%d hash=%x\n", len, hash);
+      }
+      len = 0;
+      hash = 2166136261;
+    }
+  }
+
+done:
+  while(ports[PORT_CONSOLEOUT].count)
+    ;
+  intr_off();
+  uartgetstats(&st);
+  printf("STRESS-END rx=%lu overrun=%lu rxdrop=%lu intr=%lu\n",
+         st.rx, st.overrun, st.rxdrop, st.intr);
+  uartflush();
+  uartecho(1);
+}
+
+
+#define BENCH_TIMER_EVENTS 200
+
+static volatile uint64 timer_fired;
+
+static void
+bench_timer_fn(struct ktimer *t)
+{
+  timer_fired = r_time();
+}
+
+
+// Measure timer event cost: how late one-shot timers run after
+// their deadline, and the cycles the hart spends in the trap(s)
+// that deliver each one.
+// Comparing a plain kernel with an SSTC=1 kernel shows what the
+// machine-mode timervec bounce costs.
+void
+bench_timer(void)
+{
+  struct ktimer t = { .fn = bench_timer_fn };
+  struct timerstats before, after;
+  uint64 late, late_max, trap, prev;
+
+  late = late_max = trap = 0;
+  timer_getstats(&before);
+  intr_on();
+  for(int i = 0; i < BENCH_TIMER_EVENTS; i++) {
+    timer_fired = 0;
+    timer_add(&t, r_time() + 1000 + (i * 37) % 1000);
+
+    // the loop polls every few cycles, so the pass that sees the
+    // timer fired is the one the trap(s) interrupted.
+    prev = r_cycle();
+    while(timer_fired == 0)
+      prev = r_cycle();
+    trap += r_cycle() - prev;
+
+    late += timer_fired - t.expires;
+    if(timer_fired - t.expires > late_max)
+      late_max = timer_fired - t.expires;
+  }
+  intr_off();
+  timer_getstats(&after);
+
+  printf("BENCH timer path=%s events=%d interrupts_count=%lu "
+         "late_ns=%lu late_max_ns=%lu trap_cycles=%lu\n",
+         has_sstc ? "sstc" : "timervec", BENCH_TIMER_EVENTS,
+         after.interrupts - before.interrupts,
+         mtime_to_ns(late / BENCH_TIMER_EVENTS), mtime_to_ns(late_max),
+         trap / BENCH_TIMER_EVENTS);
+  uartflush();
+}
+
+
+#define BENCH_MASK_EVENTS 200
+#define BENCH_MASK_HOLD 500  // mtime ticks per critical section, 50us
+
+static volatile int mask_events;
+static uint64 mask_late, mask_late_max;
+
+static void
+bench_mask_fn(struct ktimer *t)
+{
+  uint64 late = r_time() - t->expires;
+
+  mask_late += late;
+  if(late > mask_late_max)
+    mask_late_max = late;
+  if(++mask_events < BENCH_MASK_EVENTS)
+    timer_add(t, r_time() + 300 + (mask_events * 37) % 700);
+}
+
+
+// Measure what console critical sections cost the rest of the
+// system: one-shot timers run while mainline code holds the console
+// back-to-back for BENCH_MASK_HOLD ticks at a time, first under
+// intr_off, which holds the timer off too, then under uartmask, which
+// leaves it free. Also reports the cost of an enter/exit pair.
+void
+bench_masking(void)
+{
+  struct ktimer t = { .fn = bench_mask_fn };
+  uint64 start, cycles;
+  int mode, pairs;
+
+  for(mode = 0; mode < 2; mode++) {
+    mask_events = 0;
+    mask_late = mask_late_max = 0;
+    cycles = 0;
+    pairs = 0;
+
+    intr_on();
+    timer_add(&t, r_time() + 300);
+    while(mask_events < BENCH_MASK_EVENTS) {
+      start = r_cycle();
+      if(mode == 0)
+        intr_off();
+      else
+        uartmask();
+      cycles += r_cycle() - start;
+
+      start = r_time();
+      while(r_time() - start < BENCH_MASK_HOLD)
+        ;
+
+      start = r_cycle();
+      if(mode == 0)
+        intr_on();
+      else
+        uartunmask();
+      cycles += r_cycle() - start;
+      pairs++;
+    }
+    intr_off();
+
+    printf("BENCH masking mode=%s events=%d hold_ticks=%d late_us=%lu "
+           "late_max_us=%lu enter_exit_cycles=%lu\n",
+           mode == 0 ? "intr_off" : "uartmask", BENCH_MASK_EVENTS,
+           BENCH_MASK_HOLD, mtime_to_us(mask_late / BENCH_MASK_EVENTS),
+           mtime_to_us(mask_late_max), cycles / pairs);
+    uartflush();
+  }
+}
+
+
+#define BENCH_TRAP_EVENTS 1000
+
+// Measure the round trip of a supervisor software interrupt raised
+// here through each kernel trap entry: kernelvec saving every
+// register, then the vectored table's kernelintrvec saving only the
+// caller-saved ones. timervec did not mark it, so ktrap takes it for
+// neither tick nor IPI, with or without Sstc.
+void
+bench_trapentry(void)
+{
+  uint64 start, cycles;
+  int vectored;
+
+  for(vectored = 0; vectored < 2; vectored++) {
+    ktrapvec(vectored);
+    cycles = 0;
+    intr_on();
+    for(int i = 0; i < BENCH_TRAP_EVENTS; i++) {
+      start = r_cycle();
+      w_sip(r_sip() | SIE_SSIE);  // same bit in sip
+      cycles += r_cycle() - start;
+    }
+    intr_off();
+
+    printf("BENCH trapentry path=%s events=%d trap_cycles=%lu\n",
+           vectored ? "vectored" : "direct", BENCH_TRAP_EVENTS,
+           cycles / BENCH_TRAP_EVENTS);
+    uartflush();
+  }
+}
+
+
+#define BENCH_IPI_EVENTS 200
+
+// Measure an IPI from ipi_send here to ipi_intr on another hart,
+// asleep in the scheduler's idle wfi with its tick stopped. Needs
+// a kernel booted with CPUS=2 or more.
+void
+bench_ipi(void)
+{
+  struct schedstats ss;
+  struct ipistats before, st;
+  uint64 deadline, n;
+  int hart;
+
+  for(hart = 1; hart < NCPU; hart++) {
+    sched_getstats(hart, &ss);
+    if(ss.start)
+      break;
+  }
+  if(hart == NCPU) {
+    printf("BENCH ipi skipped, needs CPUS=2 or more\n");
+    uartflush();
+    return;
+  }
+
+  ipi_getstats(hart, &before);
+  for(int i = 0; i < BENCH_IPI_EVENTS; i++) {
+    ipi_getstats(hart, &st);
+    n = st.received;
+    ipi_send(hart);
+    deadline = r_time() + us_to_mtime(10000);
+    do {
+      ipi_getstats(hart, &st);
+    } while(st.received == n && r_time() < deadline);
+    // let it fall asleep again.
+    deadline = r_time() + us_to_mtime(100);
+    while(r_time() < deadline)
+      ;
+  }
+
+  ipi_getstats(hart, &st);
+  // an IPI the hart did not take before its deadline is lost.
+  n = st.received - before.received;
+  printf("BENCH ipi hart=%d events=%d lost_count=%lu lat_us=%lu "
+         "lat_max_us=%lu\n", hart, BENCH_IPI_EVENTS,
+         n < BENCH_IPI_EVENTS ? BENCH_IPI_EVENTS - n : 0,
+         n ? mtime_to_us((st.lat - before.lat) / n) : 0,
+         mtime_to_us(st.lat_max));
+  uartflush();
+}
+
+
+#define BENCH_PINGPONG_ROUNDS 1000
+
+extern char pingpong_elf[];  // pingpong.S
+
+// Two processes bounce a byte back and forth over two ports, each
+// sleeping in sys_port_read until the other writes, so every round
+// trip is two sched_wakeups. Hart 0 stays here, so they run on the
+// other harts: with CPUS=3 or more each can have a hart to itself,
+// and every wakeup is an IPI. Leaves switches, steals and wakeup
+// latencies for sched_stats to print.
+void
+bench_pingpong(void)
+{
+  struct schedstats ss;
+  struct proc *p[2];
+  int port[2], harts = 0, done;
+  uint64 start, t;
+
+  for(int i = 1; i < NCPU; i++) {
+    sched_getstats(i, &ss);
+    if(ss.start)
+      harts++;
+  }
+  if(harts == 0) {
+    printf("BENCH pingpong skipped, needs CPUS=2 or more\n");
+    uartflush();
+    return;
+  }
+
+  // the scheduling harts run kernel code under biglock, and may
+  // pick a process up as soon as proc_load_elf makes it RUNNABLE.
+  acquire(&biglock);
+  proc_init();
+  for(int i = 0; i < 2; i++) {
+    p[i] = proc_alloc();
+    if(p[i] == 0 || proc_load_elf(p[i], pingpong_elf) < 0)
+      panic("bench_pingpong: proc");
+    port[i] = port_acquire(-1, p[i]->pid);
+    if(port[i] < 0)
+      panic("bench_pingpong: port");
+  }
+  for(int i = 0; i < 2; i++) {
+    p[i]->trapframe->a1 = port[i];
+    p[i]->trapframe->a2 = port[1 - i];
+    p[i]->trapframe->a3 = BENCH_PINGPONG_ROUNDS;
+    p[i]->trapframe->a4 = i == 0;
+  }
+  start = r_time();
+  for(int i = 0; i < 2; i++)
+    sched_wakeup(p[i]);
+  release(&biglock);
+
+  // sys_terminate frees each one when it is done.
+  do {
+    __sync_synchronize();
+    done = p[0]->state == UNUSED && p[1]->state == UNUSED;
+    t = r_time() - start;
+  } while(!done && t < us_to_mtime(10000000));
+
+  if(!done) {
+    printf("BENCH pingpong timed out\n");
+    uartflush();
+    return;
+  }
+  port_close(port[0]);
+  port_close(port[1]);
+  printf("BENCH pingpong harts=%d rounds=%d rtt_us=%lu\n", harts,
+         BENCH_PINGPONG_ROUNDS,
+         mtime_to_us(t / BENCH_PINGPONG_ROUNDS));
+  uartflush();
+}
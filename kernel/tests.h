@@ -4,5 +4,19 @@
 void test_uart();
 void disk_test();
 void port_test(void);
+void test_port_wait(void);
+
+// benchmarks, run by kernels built with BENCH=1
+void bench_printint(void);
+void bench_uart(void);
+void bench_ports(void);
+void bench_timer(void);
+void bench_masking(void);
+void bench_trapentry(void);
+void bench_ipi(void);
+void bench_pingpong(void);
+
+// console stress target for utils/stress.py, built with STRESS=1
+void stress_console(void);
 
 #endif // TESTS_H
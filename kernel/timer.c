@@ -0,0 +1,485 @@
+//
+// kernel timers.
+//
+// timervec (kernelvec.S) takes the machine-mode timer interrupt and
+// turns it into a supervisor software interrupt. ktrap spots that
+// and calls clockintr before handing the trap to kerneltrap. On a
+// CPU with Sstc (built with SSTC=1), the supervisor timer interrupt
+// arrives directly from stimecmp instead, one trap per event.
+//
+// Each hart keeps its own timers, in a timerbase: timer_add files a
+// timer with the calling hart, whose interrupt runs it. Pending
+// timers sit in a hierarchical timing wheel: WHEEL_LEVELS arrays of
+// WHEEL_SIZE slots, each slot a list of timers. A level-0 slot
+// covers one unit of 2^UNIT_SHIFT mtime ticks; a level-n slot covers
+// WHEEL_SIZE^n units. Adding and cancelling a timer is a list insert
+// or unlink. As time reaches a higher-level slot, its timers cascade
+// down to finer slots, and level-0 timers fire once mtime passes
+// their exact deadline. After each interrupt, clockintr programs
+// this hart's mtimecmp for the next deadline, so a timer fires on
+// time rather than on the next periodic tick.
+//
+// In tickless mode, timer_idle takes the periodic tick off the wheel
+// while the hart waits in wfi, so an idle hart sleeps until its next
+// real deadline instead of waking every TICK_INTERVAL.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "mem.h"
+#include "timer.h"
+#include "spinlock.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define UNIT_SHIFT 10  // level-0 slot: 1024 mtime ticks, about 100us
+
+// the farthest deadline the wheel can hold, in units; later ones
+// wait in the last slot and are re-filed as time passes.
+#define WHEEL_SPAN (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define NEVER (~0UL)
+
+volatile uint64 ticks;
+
+// one hart's timers. lock guards the wheel and the timers on it.
+struct timerbase {
+  struct spinlock lock;
+  struct ktimer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+  uint64 pending[WHEEL_LEVELS];  // bit s set if wheel[l][s] is non-empty
+  uint64 now;                    // first unit not yet fully expired
+  uint64 cascaded;               // last unit whose cascade has run
+  int ready;                     // wheel started on this hart
+  struct ktimer tick;            // the periodic tick
+  struct timerstats stats;
+};
+
+static struct timerbase bases[NCPU];
+static int tickless = 1;
+
+// timervec's per-hart scratch areas (start.c); it sets word 6 when
+// the software interrupt it raises is a tick.
+extern uint64 timer_scratch[NCPU][7];
+
+
+static void
+enqueue(struct timerbase *b, struct ktimer *t)
+{
+  uint64 unit = t->expires >> UNIT_SHIFT;
+  uint64 delta;
+  int level, slot;
+
+  if(unit < b->now)
+    unit = b->now;
+  delta = unit - b->now;
+  if(delta >= WHEEL_SPAN)
+    unit = b->now + WHEEL_SPAN - 1;
+
+  for(level = 0; level < WHEEL_LEVELS - 1; level++){
+    if(delta < 1UL << (WHEEL_BITS * (level + 1)))
+      break;
+  }
+  slot = (unit >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+  t->next = b->wheel[level][slot];
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = &b->wheel[level][slot];
+  b->wheel[level][slot] = t;
+  b->pending[level] |= 1UL << slot;
+  t->base = b;
+}
+
+
+static void
+unlink(struct ktimer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->pprev = 0;
+}
+
+
+// Move the whole list in a slot to *head, which then stands in for
+// the slot: a timer cancelled while on it unlinks cleanly.
+static void
+detach(struct timerbase *b, int level, int slot, struct ktimer **head)
+{
+  *head = b->wheel[level][slot];
+  b->wheel[level][slot] = 0;
+  b->pending[level] &= ~(1UL << slot);
+  if(*head)
+    (*head)->pprev = head;
+}
+
+
+// b->now has reached the start of a level-0 rotation: move the
+// timers of each higher level's current slot down, for as many
+// levels as are starting a new rotation too.
+static void
+cascade(struct timerbase *b)
+{
+  struct ktimer *t, *list;
+  int level, slot;
+
+  for(level = 1; level < WHEEL_LEVELS; level++){
+    slot = (b->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    detach(b, level, slot, &list);
+    while((t = list) != 0){
+      unlink(t);
+      enqueue(b, t);
+    }
+    if(slot != 0)
+      break;
+  }
+}
+
+
+// Fire every timer whose deadline is at or before now. Called with
+// b->lock held; it is let go while each fn runs, so fn may add and
+// cancel timers, and other harts may cancel ones still on the list.
+static void
+run(struct timerbase *b, uint64 now)
+{
+  uint64 unit = now >> UNIT_SHIFT;
+  uint64 rest, next;
+  struct ktimer *t, *list;
+  int slot;
+
+  for(;;){
+    if((b->now & WHEEL_MASK) == 0 && b->cascaded != b->now){
+      b->cascaded = b->now;
+      cascade(b);
+    }
+
+    // timers may re-arm themselves from fn, and timers in the
+    // current unit may not be due yet, so work on a detached list.
+    slot = b->now & WHEEL_MASK;
+    detach(b, 0, slot, &list);
+    while((t = list) != 0){
+      unlink(t);
+      if(t->expires <= now){
+        release(&b->lock);
+        t->fn(t);
+        acquire(&b->lock);
+      } else {
+        enqueue(b, t);
+      }
+    }
+
+    if(b->now >= unit)
+      break;
+
+    // skip empty slots, as far as the end of this rotation.
+    rest = slot == WHEEL_MASK ? 0 : b->pending[0] >> (slot + 1);
+    if(rest)
+      next = b->now + 1 + __builtin_ctzl(rest);
+    else
+      next = (b->now | WHEEL_MASK) + 1;
+    b->now = next < unit ? next : unit;
+  }
+}
+
+
+static uint64
+earliest(struct ktimer *t)
+{
+  uint64 e = NEVER;
+
+  for(; t; t = t->next){
+    if(t->expires < e)
+      e = t->expires;
+  }
+  return e;
+}
+
+
+// The mtime at which run() next has work: the first pending level-0
+// timer, or the next cascade, whichever comes first.
+static uint64
+next_event(struct timerbase *b)
+{
+  int slot = b->now & WHEEL_MASK;
+  uint64 rest = b->pending[0] >> slot;
+  int level;
+
+  if(rest)
+    return earliest(b->wheel[0][slot + __builtin_ctzl(rest)]);
+  for(level = 1; level < WHEEL_LEVELS; level++){
+    if(b->pending[level])
+      return ((b->now | WHEEL_MASK) + 1) << UNIT_SHIFT;
+  }
+  if(b->pending[0])
+    return earliest(b->wheel[0][__builtin_ctzl(b->pending[0])]);
+  return NEVER;
+}
+
+
+static uint64
+comparator(void)
+{
+  if(has_sstc)
+    return r_stimecmp();
+  return *(volatile uint64*)CLINT_MTIMECMP(cpuid());
+}
+
+
+// Program this hart's comparator for the next deadline. With Sstc
+// that is stimecmp, and writing it also clears the pending interrupt.
+// Otherwise it is mtimecmp, and timervec still pushes it one
+// TICK_INTERVAL on after each interrupt, as a fallback for
+// interrupts taken from user mode, which do not come through
+// clockintr.
+static void
+program(struct timerbase *b)
+{
+  if(has_sstc)
+    w_stimecmp(next_event(b));
+  else
+    *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = next_event(b);
+}
+
+
+// the periodic tick. ticks counts hart 0's.
+static void
+tickfn(struct ktimer *t)
+{
+  uint64 next = t->expires + TICK_INTERVAL;
+
+  if(cpuid() == 0)
+    ticks++;
+
+  // after a long stall, resume the beat instead of catching up.
+  if(next <= r_time())
+    next = r_time() + TICK_INTERVAL;
+  timer_add(t, next);
+}
+
+
+void
+timer_init(void)
+{
+  // the supervisor needs the CLINT mapped to reach mtimecmp.
+  for(uint64 pa = CLINT; pa < CLINT + 0x10000; pa += PGSIZE)
+    vm_page_insert(kernel_pagetable, pa, pa, PTE_R | PTE_W);
+  sfence_vma();
+
+  timer_inithart();
+}
+
+
+void
+timer_inithart(void)
+{
+  struct timerbase *b;
+
+  push_off();
+  b = &bases[cpuid()];
+  initlock(&b->lock, "timer");
+  acquire(&b->lock);
+  b->now = r_time() >> UNIT_SHIFT;
+  b->cascaded = NEVER;
+  release(&b->lock);
+
+  b->tick.fn = tickfn;
+  timer_add(&b->tick, r_time() + TICK_INTERVAL);
+
+  acquire(&b->lock);
+  b->ready = 1;
+  program(b);
+  release(&b->lock);
+  pop_off();
+}
+
+
+// Lock the base t is filed with, if any, and return it.
+static struct timerbase*
+lockbase(struct ktimer *t)
+{
+  struct timerbase *b;
+
+  for(;;){
+    b = t->base;
+    if(b == 0)
+      return 0;
+    acquire(&b->lock);
+    // another hart may have moved it meanwhile.
+    if(t->base == b)
+      return b;
+    release(&b->lock);
+  }
+}
+
+
+// Make b the base t is filed with, taking t off any other, and
+// return with b locked. t->base only changes under the lock of the
+// base it names, or from 0 by compare-and-swap, so while b is locked
+// and still t's base no other hart can file t elsewhere. A lock is
+// never held while waiting for another.
+static void
+claim(struct ktimer *t, struct timerbase *b)
+{
+  struct timerbase *old;
+
+  for(;;){
+    old = lockbase(t);
+    if(old == b)
+      return;
+    if(old){
+      if(t->pprev)
+        unlink(t);
+      t->base = b;
+      release(&old->lock);
+    } else if(!__sync_bool_compare_and_swap(&t->base, 0, b)){
+      continue;
+    }
+    acquire(&b->lock);
+    // another hart may have claimed it meanwhile.
+    if(t->base == b)
+      return;
+    release(&b->lock);
+  }
+}
+
+
+void
+timer_add(struct ktimer *t, uint64 expires)
+{
+  struct timerbase *b;
+
+  push_off();
+  b = &bases[cpuid()];
+  claim(t, b);
+  if(t->pprev)
+    unlink(t);
+  t->expires = expires;
+  enqueue(b, t);
+
+  // the new timer may be due before the one mtimecmp holds.
+  if(b->ready && expires < comparator())
+    program(b);
+  release(&b->lock);
+  pop_off();
+}
+
+
+int
+timer_cancel(struct ktimer *t)
+{
+  struct timerbase *b;
+  int was = 0;
+
+  push_off();
+  b = lockbase(t);
+  if(b){
+    was = t->pprev != 0;
+    if(t->pprev)
+      unlink(t);
+    release(&b->lock);
+  }
+  pop_off();
+  return was;
+}
+
+
+int
+timer_pending(struct ktimer *t)
+{
+  return t->pprev != 0;
+}
+
+
+void
+timer_getstats(struct timerstats *st)
+{
+  push_off();
+  *st = bases[cpuid()].stats;
+  pop_off();
+}
+
+
+void
+timer_tickless(int on)
+{
+  tickless = on;
+}
+
+
+void
+timer_idle(void)
+{
+  int on = intr_get();
+  uint64 start, now, next, n;
+  struct timerbase *b;
+  int stopped;
+
+  intr_off();
+  b = &bases[cpuid()];
+  b->stats.idles++;
+
+  // stop the tick, and let the comparator wait for the next real
+  // deadline; if there is none, only a device will wake us.
+  stopped = b->ready && tickless && timer_cancel(&b->tick);
+  if(stopped){
+    acquire(&b->lock);
+    program(b);
+    release(&b->lock);
+  }
+
+  start = r_time();
+  asm volatile("wfi");
+  now = r_time();
+  b->stats.idle_time += now - start;
+
+  // credit the beats slept through and resume the tick on the next.
+  if(stopped){
+    next = b->tick.expires;
+    if(now >= next){
+      n = (now - next) / TICK_INTERVAL + 1;
+      if(cpuid() == 0)
+        ticks += n;
+      b->stats.skipped += n;
+      next += n * TICK_INTERVAL;
+    }
+    timer_add(&b->tick, next);
+  }
+
+  if(on)
+    intr_on();
+}
+
+
+void
+clockintr(void)
+{
+  struct timerbase *b = &bases[cpuid()];
+
+  b->stats.interrupts++;
+  if(!b->ready){
+    if(cpuid() == 0)
+      ticks++;
+    // nothing else re-arms stimecmp, or clears its interrupt.
+    if(has_sstc)
+      w_stimecmp(r_time() + TICK_INTERVAL);
+    return;
+  }
+  acquire(&b->lock);
+  run(b, r_time());
+  program(b);
+  release(&b->lock);
+}
+
+
+int
+timer_ticked(void)
+{
+  // timervec may set it again at any moment, so swap rather than
+  // read and clear.
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0) != 0;
+}
@@ -0,0 +1,126 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+#include "ktime.h"
+
+// timer ticks on hart 0 since boot.
+extern volatile uint64 ticks;
+
+// set by start() when timer interrupts come from Sstc's stimecmp
+// rather than through timervec.
+extern int has_sstc;
+
+// mtime ticks between periodic timer ticks: 10ms at 10MHz.
+#define TICK_INTERVAL (KTIME_HZ / 100)
+
+struct timerbase;
+
+// A one-shot kernel timer. The owner allocates it and sets fn (and
+// arg, if fn wants it); timer_add and timer_cancel do the rest.
+struct ktimer {
+  struct ktimer *next;
+  struct ktimer **pprev;        // 0 when not pending
+  uint64 expires;               // mtime at which fn runs
+  void (*fn)(struct ktimer *);  // called in the timer interrupt
+  void *arg;
+  struct timerbase *base;       // hart it was last filed with
+};
+
+/*
+ * Start the timer subsystem: map the CLINT for supervisor mode and
+ * start the boot hart's periodic tick. Called once, after vm_init.
+ * Parameters: None
+ * Returns: None
+ */
+void timer_init(void);
+
+/*
+ * Start the calling hart's timers and periodic tick. timer_init does
+ * this for the boot hart; every other hart calls it once.
+ * Parameters: None
+ * Returns: None
+ */
+void timer_inithart(void);
+
+/*
+ * Arm a timer, or move it if it is already pending. t->fn runs from
+ * the calling hart's timer interrupt, with interrupts off, once mtime
+ * reaches expires; a deadline already passed fires at the next
+ * interrupt.
+ * Parameters:
+ *  - t: The timer.
+ *  - expires: Absolute deadline, in mtime ticks.
+ * Returns: None
+ */
+void timer_add(struct ktimer *t, uint64 expires);
+
+/*
+ * Disarm a timer.
+ * Parameters:
+ *  - t: The timer.
+ * Returns: 1 if it was pending, 0 if it had fired or was never armed.
+ */
+int timer_cancel(struct ktimer *t);
+
+/*
+ * Returns: Non-zero if t is armed and has not fired.
+ */
+int timer_pending(struct ktimer *t);
+
+// timer counters for one hart, since it started.
+struct timerstats {
+  uint64 interrupts;  // calls to clockintr
+  uint64 idles;       // calls to timer_idle
+  uint64 idle_time;   // mtime ticks spent waiting in timer_idle
+  uint64 skipped;     // periodic ticks not taken because the hart was idle
+};
+
+/*
+ * Copy out the calling hart's timer counters.
+ * Parameters:
+ *  - st: Where to store them.
+ * Returns: None
+ */
+void timer_getstats(struct timerstats *st);
+
+/*
+ * Turn tickless idle on (the default) or off. When on, timer_idle
+ * stops the periodic tick, so only a real deadline or a device
+ * interrupt wakes the hart, and credits the skipped ticks on waking.
+ * Parameters:
+ *  - on: Non-zero for tickless idle.
+ * Returns: None
+ */
+void timer_tickless(int on);
+
+/*
+ * Idle the hart until the next interrupt, with wfi. Interrupts are
+ * taken on return if they were on at the call. Call it from loops
+ * that wait for an interrupt handler to make progress, having checked
+ * the loop condition with interrupts off: an interrupt that arrives
+ * after the check still ends the wfi.
+ * Parameters: None
+ * Returns: None
+ */
+void timer_idle(void);
+
+/*
+ * Handle a timer interrupt: run the timers that are due and program
+ * the next one. Called from ktrap with interrupts off, before
+ * kerneltrap acknowledges the interrupt.
+ * Parameters: None
+ * Returns: None
+ */
+void clockintr(void);
+
+/*
+ * Whether the supervisor software interrupt being handled was raised
+ * by timervec as a tick, rather than by an IPI or by the kernel
+ * itself. Clears the mark, so ask once per trap. Always 0 with Sstc.
+ * Parameters: None
+ * Returns: 1 for a tick, 0 otherwise.
+ */
+int timer_ticked(void);
+
+#endif // TIMER_H
@@ -0,0 +1,121 @@
+//
+// kernel event trace ring. see trace.h.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "console.h"
+#include "port.h"
+#include "proc.h"
+#include "trace.h"
+#include "ktime.h"
+#include "log.h"
+
+volatile int tracing;
+
+static struct trace_event ring[TRACE_NEVENT];
+static uint64 next;  // total records ever reserved; next slot is next % TRACE_NEVENT
+
+void
+trace_record(int type, uint32 arg, uint64 pc)
+{
+  struct trace_event *e;
+
+  // reserve a slot atomically, so an interrupt (or another hart)
+  // recording at the same moment gets a different one.
+  e = &ring[__sync_fetch_and_add(&next, 1) % TRACE_NEVENT];
+  e->time = r_time();
+  e->cycle = r_cycle();
+  e->pc = pc;
+  e->arg = arg;
+  e->type = type;
+  e->hart = r_tp();
+}
+
+void
+trace_start(void)
+{
+  tracing = 0;
+  next = 0;
+  tracing = 1;
+}
+
+void
+trace_stop(void)
+{
+  tracing = 0;
+}
+
+void
+trace_dump(void)
+{
+  struct trace_event *e;
+  uint64 i, first;
+
+  trace_stop();
+
+  first = next > TRACE_NEVENT ? next - TRACE_NEVENT : 0;
+  uartprintf("TRACE-BEGIN hz=%lu n=%lu lost=%lu\n",
+             KTIME_HZ, next - first, first);
+  for(i = first; i < next; i++){
+    e = &ring[i % TRACE_NEVENT];
+    uartprintf("T %lx %lx %x %x %x %lx\n",
+               e->time, e->cycle, e->hart, e->type, e->arg, e->pc);
+  }
+  uartprintf("TRACE-END\n");
+}
+
+
+//
+// Tracepoints for code that only exists in libprecompiled.a.
+// The Makefile links with --wrap for these symbols, so every call to
+// virtio_disk_start goes to __wrap_virtio_disk_start, which calls the
+// real one as __real_virtio_disk_start, and likewise for the others.
+// The port tracepoints are in lockwrap.c, with the ports' lock.
+//
+
+void __real_virtio_disk_start(void);
+void __real_virtio_disk_intr(void);
+void __real_swtch(struct context *old, struct context *new);
+
+// virtio_disk_start is polled often; only record calls that
+// actually took a command from PORT_DISKCMD.
+void
+__wrap_virtio_disk_start(void)
+{
+  int before = ports[PORT_DISKCMD].count;
+
+  __real_virtio_disk_start();
+  if(ports[PORT_DISKCMD].count < before){
+    trace(TR_DISK_SUBMIT, before - ports[PORT_DISKCMD].count, 0);
+    log_debug(LOG_DISK, "disk: took %d command bytes, %d left\n",
+              before - ports[PORT_DISKCMD].count,
+              ports[PORT_DISKCMD].count);
+  }
+}
+
+void
+__wrap_virtio_disk_intr(void)
+{
+  __real_virtio_disk_intr();
+  trace(TR_DISK_COMPLETE, 0, 0);
+  log_trace(LOG_DISK, "disk: request complete\n");
+}
+
+void
+__wrap_swtch(struct context *old, struct context *new)
+{
+  struct proc *p;
+  int pid = 0;
+
+  if(tracing){
+    // a switch into this hart's scheduler carries no pid.
+    if(new != &mycpu()->context){
+      p = (struct proc*)((char*)new - __builtin_offsetof(struct proc, context));
+      pid = p->pid;
+    }
+    trace_record(TR_SWITCH, pid, new->ra);
+  }
+  __real_swtch(old, new);
+}
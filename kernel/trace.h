@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+
+// Kernel event tracing.
+//
+// Tracepoints append fixed-size binary records, stamped with the time
+// and cycle counters, to a ring in memory. The ring overwrites its
+// oldest records when full. trace_dump() prints the ring over the
+// UART; utils/trace2json.py turns that into a Chrome/Perfetto trace.
+//
+// A tracepoint costs one load and a branch while tracing is stopped.
+
+// Event types. The meaning of arg and pc for each is noted alongside;
+// utils/trace2json.py must agree with this list.
+#define TR_TRAP_ENTER    1  // arg: scause          pc: sepc
+#define TR_TRAP_EXIT     2  // arg: scause
+#define TR_PLIC_CLAIM    3  // arg: irq
+#define TR_PLIC_COMPLETE 4  // arg: irq           pc: hart that claimed it
+#define TR_UART_RX       5  // arg: byte
+#define TR_UART_TX       6  // arg: byte
+#define TR_PORT_READ     7  // arg: port<<16 | bytes  pc: caller
+#define TR_PORT_WRITE    8  // arg: port<<16 | bytes  pc: caller
+#define TR_DISK_SUBMIT   9  // arg: command bytes taken from PORT_DISKCMD
+#define TR_DISK_COMPLETE 10 //
+#define TR_SWITCH        11 // arg: pid switched to, 0 for scheduler  pc: its ra
+
+#define TRACE_NEVENT 4096   // records in the ring; a power of two
+
+struct trace_event {
+  uint64 time;   // time CSR (mtime ticks)
+  uint64 cycle;  // cycle CSR
+  uint64 pc;
+  uint32 arg;
+  uint16 type;
+  uint16 hart;
+};
+
+extern volatile int tracing;
+
+void trace_record(int type, uint32 arg, uint64 pc);
+
+static inline void
+trace(int type, uint32 arg, uint64 pc)
+{
+  if(tracing)
+    trace_record(type, arg, pc);
+}
+
+/*
+ * Start recording events, discarding anything already in the ring.
+ * Parameters: None
+ * Returns: None
+ */
+void trace_start(void);
+
+/*
+ * Stop recording events. The ring keeps its contents.
+ * Parameters: None
+ * Returns: None
+ */
+void trace_stop(void);
+
+/*
+ * Stop tracing and print the ring, oldest record first, directly to
+ * the UART (polling, so it works from panic and with interrupts off).
+ * Output is one "T time cycle hart type arg pc" line of hex fields
+ * per record, between "TRACE-BEGIN" and "TRACE-END" lines.
+ * Parameters: None
+ * Returns: None
+ */
+void trace_dump(void);
+
+#endif // TRACE_H
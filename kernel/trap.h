@@ -21,10 +21,131 @@ void trapinit(void);
  */
 void usertrapret(void);
 
+/*
+ * Handle an interrupt or exception taken in supervisor mode.
+ * Called from ktrap() with the interrupted registers saved by kernelvec.
+ */
+void kerneltrap(void);
+
+/*
+ * Point this hart's stvec at the vectored trap table, so timer and
+ * device interrupts take the short kernelintrvec entry, or back at
+ * kernelvec alone, which saves every register for every trap.
+ * trapinit installs kernelvec; main switches to the table after it.
+ * Parameters:
+ *   - vectored: Non-zero for the vectored table.
+ * Returns:
+ *   - None
+ */
+void ktrapvec(int vectored);
+
+/*
+ * Entry point from kernelvec for every kernel-mode trap. Runs the
+ * trap hooks (tracing, profiling, timer tick) around kerneltrap().
+ * regs points at the registers kernelvec saved on the stack; after
+ * kernelintrvec, only the caller-saved ones and s0 are valid.
+ */
+void ktrap(uint64 *regs);
+
+/*
+ * Serve an interrupt taken in user mode as ktrap() would, before the
+ * precompiled usertrap() sees it: devices through plic_dispatch(),
+ * the tick through clockintr(), then the tasklets. An Sstc tick is
+ * passed on as a software interrupt, which usertrap() yields on.
+ * Called by userenter() with biglock held and stvec on the kernel
+ * vector; does nothing for an exception or system call.
+ */
+void ktrap_user(void);
+
+// mtime at entry to each hart's current kernel trap (ktrap.c).
+extern uint64 trapstart[];
+
 //plicinit.c
 void plicinit(void);
+
+/*
+ * Set up the calling hart's PLIC context: enable the IRQs routed to
+ * it (see irq_set_affinity) and set its threshold to 0. plicinit
+ * does this for the boot hart; every other hart calls it once.
+ */
+void plicinithart(void);
 int plic_claim(void);
 void plic_complete(int);
 
+/*
+ * Install the handler for a device interrupt and set its priority.
+ * An IRQ not yet routed anywhere is routed to the calling hart.
+ * Parameters:
+ *   - irq: The PLIC interrupt source, 1 to 63.
+ *   - handler: Called from plic_dispatch with the IRQ claimed.
+ *   - priority: 1 (lowest) to 7.
+ * Returns:
+ *   - 0 on success, -1 if an argument is out of range.
+ */
+int irq_register(int irq, void (*handler)(void), int priority);
+
+/*
+ * Route an IRQ to a set of harts. The PLIC delivers each interrupt
+ * to one of them.
+ * Parameters:
+ *   - irq: The PLIC interrupt source, 1 to 63.
+ *   - mask: Bit n set routes the IRQ to hart n; must not be 0.
+ * Returns:
+ *   - 0 on success, -1 if an argument is out of range.
+ */
+int irq_set_affinity(int irq, uint64 mask);
+
+/*
+ * Get the set of harts an IRQ is routed to, as a bit mask.
+ */
+uint64 irq_affinity(int irq);
+
+/*
+ * Mask or unmask an IRQ on the calling hart only, leaving its routing
+ * alone. irq_enable does nothing if the IRQ is not routed here.
+ * Parameters:
+ *   - irq: The PLIC interrupt source, 1 to 63.
+ * Returns:
+ *   - None
+ */
+void irq_disable(int irq);
+void irq_enable(int irq);
+
+/*
+ * Set a hart's S-mode priority threshold. Only IRQs with a priority
+ * strictly above it are delivered to that hart.
+ * Parameters:
+ *   - hart: The hart.
+ *   - threshold: 0 (deliver everything) to 7 (deliver nothing).
+ * Returns:
+ *   - None
+ */
+void plic_set_threshold(int hart, int threshold);
+
+/*
+ * Get a hart's S-mode priority threshold.
+ */
+int plic_threshold(int hart);
+
+/*
+ * Claim, handle and complete device interrupts until none are
+ * pending for this hart.
+ * Returns:
+ *   - The number of interrupts served.
+ */
+int plic_dispatch(void);
+
+/*
+ * Print, for every IRQ that has been claimed, its claims by hart and
+ * log2 histograms of its service time (claim to complete) and of its
+ * wait (trap entry to claim), in mtime ticks.
+ */
+void plic_stats(void);
+
+/*
+ * Zero the IRQ histograms.
+ */
+void plic_stats_reset(void);
+
 
 #endif // TRAP_H
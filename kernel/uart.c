@@ -2,11 +2,20 @@
 // low-level driver routines for 16550a UART.
 //
 #include "types.h"
+#include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "console.h"
 #include "port.h"
 #include "string.h"
+#include "log.h"
+#include "trace.h"
+#include "timer.h"
+#include "ktime.h"
+#include "tasklet.h"
+#include "trap.h"
+#include "spinlock.h"
+#include "proc.h"
 
 // the UART control registers are memory-mapped
 // at address UART0. this macro returns the
@@ -14,6 +23,7 @@
 #define Reg(reg) ((volatile unsigned char *)(UART0 + reg))
 
 static int             uartgetc(void);
+static void            txstart(void);
 
 // the UART control registers.
 // some have different meanings for
@@ -27,13 +37,18 @@ static int             uartgetc(void);
 #define FCR 2                 // FIFO control register
 #define FCR_FIFO_ENABLE (1<<0)
 #define FCR_FIFO_CLEAR (3<<1) // clear the content of the two FIFOs
+#define FIFO_SIZE 16          // bytes in each of the 16550 FIFOs
 #define ISR 2                 // interrupt status register
 #define LCR 3                 // line control register
 #define LCR_EIGHT_BITS (3<<0)
 #define LCR_BAUD_LATCH (1<<7) // special mode to set baud rate
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
-#define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define LSR_OVERRUN (1<<1)    // input arrived with the RX FIFO full; lost
+#define LSR_TX_IDLE (1<<5)    // THR (the whole TX FIFO) is empty
+#define LSR_TX_EMPTY (1<<6)   // TX FIFO and shift register both empty
+
+#define UART_BAUD_BASE 115200 // input clock / 16; divisor = this / baud
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
@@ -41,16 +56,138 @@ static int             uartgetc(void);
 
 extern volatile int panicked; // from printf.c
 
+// guards the transmit side: the urgent lane and the TX FIFO.
+static struct spinlock uartlock;
+
+// the urgent output queue. uartstart always sends from here before
+// PORT_CONSOLEOUT, so a warning does not wait behind bulk output.
+#define URGENT_BUF_SIZE 256
+static struct {
+  char buffer[URGENT_BUF_SIZE];
+  int head, tail;
+  int count;
+  int dropped;  // bytes lost because the queue was full
+} urgent;
+
+// bytes uartintr has taken from the RX FIFO, waiting for rxwork to
+// edit, echo and deliver them. uartintr only adds at tail and rxwork
+// only removes at head, so neither needs the other locked out.
+#define RX_BUF_SIZE 256
+static struct {
+  char buffer[RX_BUF_SIZE];
+  volatile uint head, tail;  // free-running; index with % RX_BUF_SIZE
+} rx;
+
+static void rxwork(struct tasklet *t);
+static struct tasklet rxtasklet = { .fn = rxwork };
+
+// coalesced output. when on, uartkick leaves short output queued
+// until a FIFO's worth has built up or the deadline passes; a
+// one-shot timer flushes whatever is left.
+#define COALESCE_BYTES FIFO_SIZE
+#define COALESCE_DELAY us_to_mtime(1000)
+static int coalesce;
+static void coalesce_expired(struct ktimer *t);
+static struct ktimer deadline = { .fn = coalesce_expired };
+static void txwork(struct tasklet *t);
+static struct tasklet txtasklet = { .fn = txwork };
+
+// bytes uartstart puts in the TX FIFO per kick; 1 means one
+// interrupt per byte.
+static int txburst = FIFO_SIZE;
+
+// whether uartintr echoes input back to the terminal.
+static int echo = 1;
+
+static struct uartstats stats;
+
+// uartmask nesting depth, per hart. only the outermost pair touches
+// the PLIC.
+static int masked[NCPU];
+// rxwork found the UART masked on the hart it ran on, and left the
+// input for that hart's last uartunmask.
+static int rxheld[NCPU];
+
+// cycles spent in the driver are counted from the outermost
+// driver entry point, so nested calls (uartintr -> uartstart)
+// are not counted twice. the entry points run with interrupts off,
+// or in a tasklet, which runs on one hart at a time.
+static int depth[NCPU];
+static uint64 entered[NCPU];
+
+static inline void
+drv_enter(void)
+{
+  if(depth[r_tp()]++ == 0)
+    entered[r_tp()] = r_cycle();
+}
+
+static inline void
+drv_exit(void)
+{
+  if(--depth[r_tp()] == 0)
+    __sync_fetch_and_add(&stats.cycles, r_cycle() - entered[r_tp()]);
+}
+
 
 // Initialize the UART driver 
 void
 uartinit(void)
 {
-  // Initialize the UART driver to operate at 38.4K baud, with 8-bit
-  // words and no parity. Enable and reset FIFOs and enable TX and RX 
-  // interrupts. There is basically only one way to accomplish this, 
-  // so you should probably go looking for code to copy from xv6!
-  // YOUR CODE HERE
+  initlock(&uartlock, "uart");
+
+  // disable interrupts.
+  WriteReg(IER, 0x00);
+
+  // 38.4K baud, 8 bit words, no parity.
+  uartsetbaud(38400);
+
+  // reset and enable FIFOs.
+  WriteReg(FCR, FCR_FIFO_ENABLE | FCR_FIFO_CLEAR);
+
+  // enable transmit and receive interrupts.
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+
+  log_debug(LOG_UART, "uart: 38400 baud 8N1, fifo on\n");
+}
+
+
+// Set the line speed. Also sets 8 bit words with no parity.
+void
+uartsetbaud(int baud)
+{
+  int divisor = UART_BAUD_BASE / baud;
+
+  // special mode to set baud rate.
+  WriteReg(LCR, LCR_BAUD_LATCH);
+
+  // LSB and MSB of the divisor.
+  WriteReg(0, divisor & 0xff);
+  WriteReg(1, (divisor >> 8) & 0xff);
+
+  // leave set-baud mode,
+  // and set word length to 8 bits, no parity.
+  WriteReg(LCR, LCR_EIGHT_BITS);
+}
+
+
+// Set how many bytes uartstart loads into the TX FIFO at once.
+void
+uartsetburst(int n)
+{
+  if(n < 1)
+    n = 1;
+  if(n > FIFO_SIZE)
+    n = FIFO_SIZE;
+  txburst = n;
+}
+
+
+void
+uartgetstats(struct uartstats *st)
+{
+  *st = stats;
+  st->urgent_dropped = urgent.dropped;
 }
 
 
@@ -59,22 +196,161 @@ uartinit(void)
 void 
 uartstart(void)
 {
-    // This function starts the UART for interrupt driven output, which 
-    // allows the system to continue doing other things while characters
-    // are being sent out the UART. In our kernel, characters are printed
-    // from the console output port (ports[PORT_CONSOLEOUT]). What this
-    // function does is the following:
-    // 1. Check if the PORT_CONSOLEOUT port has any characters in it.
-    //    If it does not, return immediately. (NOTE: You want to do this
-    //    by looking at the "count" field in port. DO NOT read the character
-    //    yet as you may not be sending this character.)
-    // 2. Check if the UART transmit holding register is full. If it is,
-    //    return immediately. The UART will interrupt when it is ready for
-    //    a new byte.
-    // 3. Read the next character from the PORT_CONSOLEOUT port using 
-    //    port_read.
-    // 4. Send the character out the UART by writing it to the THR register.
-    // YOUR CODE HERE
+  acquire(&uartlock);
+  txstart();
+  release(&uartlock);
+}
+
+
+// uartstart, with uartlock held.
+static void
+txstart(void)
+{
+  char c;
+  int n;
+
+  // nothing to send.
+  if(urgent.count == 0 && ports[PORT_CONSOLEOUT].count == 0)
+    return;
+
+  // the UART transmit FIFO still holds bytes, so leave it be.
+  // it will interrupt when it has drained.
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+    return;
+
+  drv_enter();
+
+  // the FIFO is empty: refill it, so the next interrupt comes
+  // txburst bytes from now instead of one.
+  // urgent output always goes first.
+  for(n = 0; n < txburst; n++){
+    if(urgent.count > 0){
+      c = urgent.buffer[urgent.head];
+      urgent.head = (urgent.head + 1) % URGENT_BUF_SIZE;
+      urgent.count--;
+    } else if(port_read(PORT_CONSOLEOUT, &c, 1) != 1){
+      break;
+    }
+    trace(TR_UART_TX, c, 0);
+    WriteReg(THR, c);
+  }
+  stats.tx += n;
+  if(timer_pending(&deadline))
+    timer_cancel(&deadline);
+
+  drv_exit();
+}
+
+
+// Output has been queued on PORT_CONSOLEOUT. Start sending it now,
+// or, when coalescing, once enough has built up to fill the FIFO.
+void
+uartkick(void)
+{
+  if(!coalesce || ports[PORT_CONSOLEOUT].count >= COALESCE_BYTES){
+    uartstart();
+    return;
+  }
+
+  if(!timer_pending(&deadline))
+    timer_add(&deadline, r_time() + COALESCE_DELAY);
+}
+
+
+// Coalesced output has waited COALESCE_DELAY: send it. The timer
+// interrupt is not masked by uartmask, so it may have cut into a
+// printf on this hart; leave the sending to a tasklet.
+static void
+coalesce_expired(struct ktimer *t)
+{
+  tasklet_schedule(&txtasklet);
+}
+
+static void
+txwork(struct tasklet *t)
+{
+  uartmask();
+  uartstart();
+  uartunmask();
+}
+
+
+// Turn output coalescing on or off.
+void
+uartcoalesce(int on)
+{
+  coalesce = on;
+  if(!on)
+    uartstart();
+}
+
+
+// Turn input echo on or off.
+void
+uartecho(int on)
+{
+  echo = on;
+}
+
+
+// Keep the UART's interrupt and rxwork off this hart, leaving every
+// other interrupt on. Masking IER would not do: it is shared by every
+// hart, and the PLIC may already hold a claimable UART interrupt, so
+// mask the source in this hart's PLIC context instead. Other harts
+// go on serving the UART; uartlock and portlock keep them out of the
+// queues, not this.
+void
+uartmask(void)
+{
+  push_off();
+  if(masked[cpuid()]++ == 0)
+    irq_disable(UART0_IRQ);
+  pop_off();
+}
+
+
+void
+uartunmask(void)
+{
+  int held = 0;
+
+  push_off();
+  if(masked[cpuid()] < 1)
+    panic("uartunmask");
+  if(--masked[cpuid()] == 0){
+    irq_enable(UART0_IRQ);
+    held = rxheld[cpuid()];
+    rxheld[cpuid()] = 0;
+  }
+  pop_off();
+
+  // run the input rxwork left while it was masked here.
+  if(held){
+    tasklet_schedule(&rxtasklet);
+    if(intr_get())
+      tasklet_run();
+  }
+}
+
+
+// Queue bytes on the urgent output lane and start sending.
+int
+uarturgent(char *buf, int n)
+{
+  int i;
+
+  // uartstart drains the queue, on any hart.
+  acquire(&uartlock);
+  for(i = 0; i < n && urgent.count < URGENT_BUF_SIZE; i++){
+    urgent.buffer[urgent.tail] = buf[i];
+    urgent.tail = (urgent.tail + 1) % URGENT_BUF_SIZE;
+    urgent.count++;
+  }
+  urgent.dropped += n - i;
+  txstart();
+  release(&uartlock);
+
+  return i;
 }
 
 
@@ -82,10 +358,17 @@ uartstart(void)
 void
 uartputc(int c)
 {
-  // If we are panicked, this function should hard lock and spin for
-  // ever. Otherwise, write the chracter c immediately to the uart
-  // port bypassing all interrupt schemes.
-  // YOUR CODE HERE
+  // a panic on another path has frozen the console.
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  // wait for Transmit Holding Empty to be set in LSR.
+  while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+    ;
+  WriteReg(THR, c);
+  stats.tx++;
 }
 
 
@@ -95,10 +378,34 @@ uartputc(int c)
 void
 uartflush()
 {
-  // While there is a character in the PORT_CONSOLEOUT port, 
-  // fetch one charater and send it out the uart.
-  // This function will use port_read and uartputc
-  // YOUR CODE HERE
+  char c;
+
+  uartmask();
+  acquire(&uartlock);
+  drv_enter();
+
+  while(urgent.count > 0){
+    uartputc(urgent.buffer[urgent.head]);
+    urgent.head = (urgent.head + 1) % URGENT_BUF_SIZE;
+    urgent.count--;
+  }
+
+  while(port_read(PORT_CONSOLEOUT, &c, 1) == 1)
+    uartputc(c);
+
+  drv_exit();
+  release(&uartlock);
+  uartunmask();
+}
+
+
+// Wait for the transmitter to send its last bit: the TX FIFO can
+// still hold a burst after the port has drained.
+void
+uartdrain(void)
+{
+  while((ReadReg(LSR) & LSR_TX_EMPTY) == 0)
+    ;
 }
 
 
@@ -107,30 +414,133 @@ uartflush()
 static int
 uartgetc(void)
 {
-  // Read a character from the UART and return it as an integer.
-  // If the UART has now character available, return -1 instead.
-  // YOUR CODE HERE
+  int lsr = ReadReg(LSR);
+
+  // reading LSR clears the overrun flag, so count it now.
+  if(lsr & LSR_OVERRUN)
+    stats.overrun++;
+
+  if(lsr & LSR_RX_READY){
+    // input data is ready.
+    return ReadReg(RHR);
+  } else {
+    return -1;
+  }
+}
+
+
+// Remove the last character of the current input line from
+// PORT_CONSOLEIN. Returns 1 if a character was removed.
+static int
+uarterase(void)
+{
+  struct port *p = &ports[PORT_CONSOLEIN];
+  int last, erased = 0;
 
-  return -1;
+  acquire(&portlock);
+  last = (p->tail + PORT_BUF_SIZE - 1) % PORT_BUF_SIZE;
+  if(p->count > 0 && p->buffer[last] != '\n'){
+    p->tail = last;
+    p->count--;
+    erased = 1;
+  }
+  release(&portlock);
+  return erased;
 }
 
 
 // Handle a uart interrupt, raised because input has
 // arrived, or the uart is ready for more output, or
 // both. called from trap.c.
+// this is the top half: it empties the RX FIFO into rx and refills
+// the TX FIFO, and leaves the rest of input processing to rxwork,
+// which runs once the trap's handlers are done, with interrupts on.
 void
 uartintr(void)
 {
-  // Read all incoming characters and add them to the PORT_CONSOLEIN
-  // port. Echo the characters to the screen by adding them to
-  // PORT_CONSOLEOUT as well. Note that some characters require extra
-  // work. The terminal will send carriage return (\r) when enter is
-  // pressed, these should be translated into newline (\n) characters
-  // in order to work as expected. 
-  // HINT: uartgetc and its return values are your friend...
-  //
-  // After all input has been processed, call uartstart to begin
-  // character echo.
-  // BONUS OPPORTUNITY: Make backspace work properly for extra credit.
-  // YOUR CODE HERE
+  int c;
+
+  drv_enter();
+  stats.intr++;
+
+  // acknowledge the interrupt. reading ISR clears a pending
+  // transmit-holding-empty interrupt.
+  ReadReg(ISR);
+
+  // read incoming characters.
+  while((c = uartgetc()) != -1){
+    trace(TR_UART_RX, c, 0);
+    stats.rx++;
+    if(rx.tail - rx.head == RX_BUF_SIZE){
+      stats.rxdrop++;
+      continue;
+    }
+    rx.buffer[rx.tail % RX_BUF_SIZE] = c;
+    rx.tail++;
+  }
+  if(rx.tail != rx.head)
+    tasklet_schedule(&rxtasklet);
+
+  // send buffered characters.
+  uartstart();
+
+  drv_exit();
+}
+
+
+// Bottom half of uartintr: line editing, CR translation and echo,
+// and delivery to PORT_CONSOLEIN.
+static void
+rxwork(struct tasklet *t)
+{
+  int c, held;
+  char ch;
+
+  // a trap that cut into a uartmask section on this hart runs its
+  // tasklets on the way out; leave the input to its uartunmask.
+  push_off();
+  held = masked[cpuid()] != 0;
+  if(held)
+    rxheld[cpuid()] = 1;
+  pop_off();
+  if(held)
+    return;
+
+  drv_enter();
+  while(rx.head != rx.tail){
+    c = rx.buffer[rx.head % RX_BUF_SIZE] & 0xff;
+    rx.head++;
+    log_trace(LOG_UART, "uart: rx %x\n", c);
+
+    if(c == '\b' || c == 0x7f){
+      // backspace: drop the last input character and erase
+      // it on the terminal.
+      if(uarterase() && echo){
+        uartmask();
+        consolewrite("\b \b", 3);
+        uartunmask();
+      }
+      continue;
+    }
+
+    ch = c == '\r' ? '\n' : c;
+    if(port_write(PORT_CONSOLEIN, &ch, 1) != 1){
+      stats.rxdrop++;
+      log_debug(LOG_UART, "uart: input port full, dropped %x\n", c);
+    }
+    // uartintr's uartstart reads PORT_CONSOLEOUT.
+    if(echo){
+      uartmask();
+      consolewrite(&ch, 1);
+      uartunmask();
+    }
+  }
+
+  // send the echo.
+  if(echo){
+    uartmask();
+    uartstart();
+    uartunmask();
+  }
+  drv_exit();
 }
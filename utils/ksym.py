@@ -0,0 +1,47 @@
+# Symbol lookup against kernel/kernel.sym, shared by the utils/ tools.
+#
+# kernel.sym is written by the Makefile: one "address name" line per
+# symbol from objdump -t.
+
+import bisect
+
+
+class Symbols:
+    """Map kernel addresses to the symbol they fall in."""
+
+    def __init__(self, path=None):
+        table = []
+        if path:
+            with open(path) as f:
+                for line in f:
+                    parts = line.split()
+                    # skip local labels such as .L0 and $x
+                    if len(parts) != 2 or parts[1].startswith((".", "$")):
+                        continue
+                    table.append((int(parts[0], 16), parts[1]))
+        table.sort()
+        self.addrs = [a for a, _ in table]
+        self.names = [n for _, n in table]
+
+    def function(self, pc):
+        """Name of the symbol containing pc, or None."""
+        i = bisect.bisect_right(self.addrs, pc) - 1
+        if pc == 0 or i < 0:
+            return None
+        return self.names[i]
+
+    def lookup(self, pc):
+        """"name+0xoff" for pc, or None."""
+        i = bisect.bisect_right(self.addrs, pc) - 1
+        if pc == 0 or i < 0:
+            return None
+        return "%s+0x%x" % (self.names[i], pc - self.addrs[i])
+
+
+def load(path, warn):
+    """Load path, or return an empty table after calling warn()."""
+    try:
+        return Symbols(path)
+    except OSError as e:
+        warn("no symbols from %s: %s" % (path, e.strerror))
+        return Symbols()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+#
+# Symbolize HAWX profiler samples.
+#
+# Build with "make PROF=1", capture the console, and let the kernel
+# panic; panic prints the samples between PROF-BEGIN and PROF-END.
+# Then:
+#
+#   utils/prof.py console.log                  # flat profile
+#   utils/prof.py console.log --folded > out.folded
+#   flamegraph.pl out.folded > prof.svg
+#
+# The flat profile charges each sample to the function holding the
+# interrupted pc ("self") and to every function on its backtrace
+# ("total"). Folded stacks are one "outer;...;inner count" line per
+# distinct stack, the input format of Brendan Gregg's flamegraph.pl.
+
+import argparse
+import collections
+import sys
+
+import ksym
+
+
+def read_samples(lines):
+    """Return the samples of the last PROF-BEGIN/PROF-END block."""
+    samples, current = None, None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("PROF-BEGIN"):
+            current = []
+        elif line.startswith("PROF-END") and current is not None:
+            samples, current = current, None
+        elif line.startswith("P ") and current is not None:
+            current.append([int(x, 16) for x in line.split()[1:]])
+    return samples
+
+
+def stack(syms, pcs):
+    """Function names, innermost first. Return addresses point after
+    the call, so look them up one byte earlier."""
+    names = []
+    for i, pc in enumerate(pcs):
+        name = syms.function(pc if i == 0 else pc - 1)
+        names.append(name or "0x%x" % pc)
+    return names
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description="Symbolize HAWX profiler samples.")
+    ap.add_argument("log", nargs="?", help="console log (default: stdin)")
+    ap.add_argument("-s", "--sym", default="kernel/kernel.sym",
+                    help="kernel symbol file (default: kernel/kernel.sym)")
+    ap.add_argument("--folded", action="store_true",
+                    help="print folded stacks instead of a flat profile")
+    opts = ap.parse_args()
+
+    syms = ksym.load(opts.sym, lambda m: print("warning: " + m, file=sys.stderr))
+    src = open(opts.log, errors="replace") if opts.log else sys.stdin
+    samples = read_samples(src)
+    if not samples:
+        sys.exit("no PROF-BEGIN/PROF-END block found")
+
+    stacks = [stack(syms, s) for s in samples]
+
+    if opts.folded:
+        folded = collections.Counter(";".join(reversed(s)) for s in stacks)
+        for k, n in sorted(folded.items()):
+            print("%s %d" % (k, n))
+        return
+
+    self_count = collections.Counter(s[0] for s in stacks)
+    total_count = collections.Counter()
+    for s in stacks:
+        # count recursion once per sample
+        total_count.update(set(s))
+
+    n = len(stacks)
+    print("%d samples\n" % n)
+    print("%7s %7s %7s  %s" % ("self", "self%", "total%", "function"))
+    for name, c in self_count.most_common():
+        print("%7d %6.1f%% %6.1f%%  %s" %
+              (c, 100.0 * c / n, 100.0 * total_count[name] / n, name))
+    others = [k for k in total_count if k not in self_count]
+    for name in sorted(others, key=lambda k: -total_count[k]):
+        print("%7d %6.1f%% %6.1f%%  %s" %
+              (0, 0.0, 100.0 * total_count[name] / n, name))
+
+
+if __name__ == "__main__":
+    main()
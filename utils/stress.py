@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+#
+# Stress the HAWX console over a QEMU character device.
+#
+# Builds a STRESS=1 kernel, boots it with the UART on a unix socket,
+# and drives scripted input at it. The kernel (stress_console in
+# kernel/tests.c) reads every line back out of PORT_CONSOLEIN and
+# answers with its length and FNV-1a hash, or for lines starting
+# with 'E', with the line itself; this script checks each answer
+# byte for byte against what it sent.
+#
+#   utils/stress.py                        # all scenarios but soak
+#   utils/stress.py burst flood -d 30      # pick scenarios
+#   utils/stress.py soak -d 3600           # long run
+#   utils/stress.py --connect /tmp/s.sock  # kernel already running
+#
+# Scenarios:
+#   burst       pastes a block of lines in one write, at line rate
+#   flood       keeps input flowing for --duration seconds
+#   interleave  echoed lines, so output competes with input
+#   soak        flood and interleave mixed, for --duration seconds
+#
+# Exits non-zero on any lost, corrupt, or reordered line, or if the
+# driver counted an overrun or a byte dropped at PORT_CONSOLEIN.
+
+import argparse
+import collections
+import os
+import random
+import re
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# printable ASCII: no newline, carriage return or backspace, which
+# the driver would translate or act on.
+ALPHABET = bytes(range(0x20, 0x7f))
+STAMP = re.compile(rb"^\[\s*\d+\] ")
+ECHO_MAX = 255  # kernel answers longer 'E' lines with a hash
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+
+def answer(line):
+    """What stress_console prints for an input line."""
+    if line.startswith(b"E") and len(line) <= ECHO_MAX:
+        return b"ECHO " + line
+    return b"STRESS n=%d hash=%x" % (len(line), fnv1a(line))
+
+
+class Console:
+    """One connection to the kernel's UART.
+
+    send() queues lines and the expected answer to each; a reader
+    thread matches answers as they arrive. At most `window` bytes of
+    input are outstanding, so a scenario can run at full rate
+    without outrunning PORT_CONSOLEIN on purpose.
+    """
+
+    def __init__(self, sock, log):
+        self.sock = sock
+        self.log = log
+        self.cond = threading.Condition()
+        self.expect = collections.deque()  # (answer, bytes acked)
+        self.outstanding = 0
+        self.errors = []
+        self.lines = []  # other console output
+        self.closed = False
+        self.reader = threading.Thread(target=self.read, daemon=True)
+        self.reader.start()
+
+    def read(self):
+        pending = b""
+        while True:
+            try:
+                data = self.sock.recv(65536)
+            except OSError:
+                data = b""
+            if not data:
+                break
+            self.log.write(data)
+            pending += data
+            *lines, pending = pending.split(b"\n")
+            for line in lines:
+                self.answer(STAMP.sub(b"", line.rstrip(b"\r")))
+        with self.cond:
+            self.closed = True
+            self.cond.notify_all()
+
+    def answer(self, line):
+        with self.cond:
+            if not line.startswith((b"STRESS n=", b"ECHO ")):
+                self.lines.append(line)
+                self.cond.notify_all()
+                return
+            if not self.expect:
+                self.errors.append("unexpected answer %r" % line[:80])
+                return
+            want, n = self.expect.popleft()
+            if line != want:
+                self.errors.append("want %r got %r" % (want[:80], line[:80]))
+            self.outstanding -= n
+            self.cond.notify_all()
+
+    def send(self, lines, window):
+        """Send lines, keeping at most window bytes unanswered."""
+        for line in lines:
+            want = answer(line)
+            with self.cond:
+                while (self.outstanding + len(line) + 1 > window
+                       and self.expect and not self.closed):
+                    self.cond.wait()
+                if self.closed:
+                    raise RuntimeError("console closed")
+                self.expect.append((want, len(line) + 1))
+                self.outstanding += len(line) + 1
+            self.sock.sendall(line + b"\n")
+
+    def paste(self, lines):
+        """Send lines in a single write, ignoring the window."""
+        with self.cond:
+            for line in lines:
+                self.expect.append((answer(line), len(line) + 1))
+                self.outstanding += len(line) + 1
+        self.sock.sendall(b"".join(l + b"\n" for l in lines))
+
+    def drain(self, timeout):
+        with self.cond:
+            end = time.time() + timeout
+            while self.expect and not self.closed and time.time() < end:
+                self.cond.wait(end - time.time())
+            if self.expect:
+                self.errors.append("%d answers missing" % len(self.expect))
+                self.expect.clear()
+                self.outstanding = 0
+
+    def wait_for(self, prefix, timeout):
+        with self.cond:
+            end = time.time() + timeout
+            while time.time() < end:
+                for line in self.lines:
+                    if line.startswith(prefix):
+                        return line
+                if self.closed:
+                    break
+                self.cond.wait(end - time.time())
+        return None
+
+
+def line(rng, lo, hi, echo=False):
+    n = rng.randint(lo, hi)
+    body = bytes(rng.choice(ALPHABET) for _ in range(n))
+    if echo:
+        return b"E" + body
+    if body[:1] == b"E" or body == b"QUIT":
+        body = b"x" + body[1:]
+    return body
+
+
+def burst(con, rng, args):
+    total = 0
+    for _ in range(5):
+        # about 2KB in one write, twice what PORT_CONSOLEIN holds.
+        block = [line(rng, 1, 40) for _ in range(100)]
+        con.paste(block)
+        con.drain(30)
+        total += sum(len(l) + 1 for l in block)
+    return total
+
+
+def timed(con, rng, args, make):
+    total, end = 0, time.time() + args.duration
+    while time.time() < end:
+        batch = [make() for _ in range(50)]
+        con.send(batch, args.window)
+        total += sum(len(l) + 1 for l in batch)
+    return total
+
+
+def flood(con, rng, args):
+    return timed(con, rng, args, lambda: line(rng, 1, 1000))
+
+
+def interleave(con, rng, args):
+    return timed(con, rng, args, lambda: line(rng, 0, 200, echo=True))
+
+
+def soak(con, rng, args):
+    return timed(con, rng, args,
+                 lambda: line(rng, 0, 600, echo=rng.random() < 0.3))
+
+
+SCENARIOS = {"burst": burst, "flood": flood,
+             "interleave": interleave, "soak": soak}
+
+
+def boot(args, path):
+    if not args.no_clean:
+        subprocess.run(["make", "clean"], stdout=subprocess.DEVNULL,
+                       check=True)
+    out = open(".test/stress-qemu.log", "wb")
+    qemu = subprocess.Popen(
+        ["make", "qemu", "STRESS=1",
+         "SERIAL=unix:%s,server=on,wait=on" % path],
+        stdin=subprocess.DEVNULL, stdout=out, stderr=subprocess.STDOUT,
+        start_new_session=True)
+    end = time.time() + args.boot_timeout
+    while time.time() < end:
+        if qemu.poll() is not None:
+            sys.exit("make qemu failed; see .test/stress-qemu.log")
+        try:
+            s = socket.socket(socket.AF_UNIX)
+            s.connect(path)
+            return qemu, s
+        except OSError:
+            s.close()
+            time.sleep(0.2)
+    os.killpg(qemu.pid, signal.SIGTERM)
+    sys.exit("qemu did not open %s" % path)
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description="Stress the console UART over a QEMU chardev.")
+    ap.add_argument("scenarios", nargs="*",
+                    help="%s (default: all but soak)" % ", ".join(SCENARIOS))
+    ap.add_argument("-d", "--duration", type=float, default=10,
+                    help="seconds for timed scenarios (default 10)")
+    ap.add_argument("-w", "--window", type=int, default=768,
+                    help="max unanswered input bytes (default 768)")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--connect", metavar="SOCKET",
+                    help="use a kernel already listening on SOCKET")
+    ap.add_argument("--no-clean", action="store_true",
+                    help="skip make clean before building")
+    ap.add_argument("--boot-timeout", type=float, default=120)
+    ap.add_argument("--log", default=".test/stress.out",
+                    help="raw console capture (default .test/stress.out)")
+    args = ap.parse_args()
+
+    names = args.scenarios or ["burst", "flood", "interleave"]
+    for name in names:
+        if name not in SCENARIOS:
+            ap.error("unknown scenario %s" % name)
+
+    qemu = None
+    if args.connect:
+        sock = socket.socket(socket.AF_UNIX)
+        sock.connect(args.connect)
+    else:
+        path = os.path.join(tempfile.mkdtemp(), "uart.sock")
+        qemu, sock = boot(args, path)
+
+    rng = random.Random(args.seed)
+    failed = False
+    try:
+        with open(args.log, "wb") as log:
+            con = Console(sock, log)
+            if not con.wait_for(b"STRESS-READY", args.boot_timeout):
+                sys.exit("kernel never printed STRESS-READY")
+
+            for name in names:
+                start = time.time()
+                n = SCENARIOS[name](con, rng, args)
+                con.drain(30)
+                secs = time.time() - start
+                errors, con.errors = con.errors, []
+                print("STRESS scenario=%s bytes=%d secs=%.2f "
+                      "bytes_per_sec=%d errors=%d"
+                      % (name, n, secs, n / secs, len(errors)))
+                for e in errors[:10]:
+                    print("  " + e)
+                failed |= bool(errors)
+
+            sock.sendall(b"QUIT\n")
+            end = con.wait_for(b"STRESS-END", 30)
+            if end is None:
+                sys.exit("kernel never printed STRESS-END")
+            print(end.decode())
+            counts = dict(kv.split(b"=") for kv in end.split()[1:])
+            failed |= int(counts[b"overrun"]) + int(counts[b"rxdrop"]) > 0
+    finally:
+        sock.close()
+        if qemu is not None:
+            os.killpg(qemu.pid, signal.SIGTERM)
+            qemu.wait()
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
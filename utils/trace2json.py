@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# Convert a HAWX trace dump into Chrome/Perfetto trace JSON.
+#
+# Build with "make TRACE=1", capture the console (for example
+# "make qemu | tee console.log"), and let the kernel panic; panic
+# prints the trace ring between TRACE-BEGIN and TRACE-END lines.
+# Then:
+#
+#   utils/trace2json.py console.log -s kernel/kernel.sym > trace.json
+#
+# and open trace.json in https://ui.perfetto.dev or chrome://tracing.
+#
+# Event numbers and field meanings must match kernel/trace.h.
+
+import argparse
+import json
+import sys
+
+import ksym
+
+TR_TRAP_ENTER = 1
+TR_TRAP_EXIT = 2
+TR_PLIC_CLAIM = 3
+TR_PLIC_COMPLETE = 4
+TR_UART_RX = 5
+TR_UART_TX = 6
+TR_PORT_READ = 7
+TR_PORT_WRITE = 8
+TR_DISK_SUBMIT = 9
+TR_DISK_COMPLETE = 10
+TR_SWITCH = 11
+
+SCAUSE_INTR = 1 << 63
+INTERRUPTS = {1: "timer tick", 5: "timer", 9: "external"}
+IRQS = {1: "virtio disk", 10: "uart"}
+
+
+def read_dump(lines):
+    """Yield (hz, records) for each TRACE-BEGIN/TRACE-END block."""
+    hz, records = None, None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE-BEGIN"):
+            fields = dict(f.split("=") for f in line.split()[1:])
+            hz, records = int(fields["hz"]), []
+        elif line.startswith("TRACE-END") and records is not None:
+            yield hz, records
+            records = None
+        elif line.startswith("T ") and records is not None:
+            t, cyc, hart, typ, arg, pc = (int(x, 16) for x in line.split()[1:])
+            records.append((t, cyc, hart, typ, arg, pc))
+
+
+def trap_name(scause):
+    if scause & SCAUSE_INTR:
+        return INTERRUPTS.get(scause & 0xff, "interrupt %d" % (scause & 0xff))
+    return "exception %d" % scause
+
+
+def convert(hz, records, syms):
+    events = []
+    base = records[0][0] if records else 0
+    # claims not yet completed, by (claiming hart, irq). a deferred
+    # completion may run on another hart, so each IRQ becomes one
+    # complete ("X") slice on the claiming hart, not a B/E pair.
+    claims = {}
+
+    def ev(ph, name, t, hart, **kw):
+        e = {"ph": ph, "name": name, "pid": 0, "tid": hart,
+             "ts": (t - base) * 1e6 / hz}
+        if ph == "i":
+            e["s"] = "t"
+        e.update(kw)
+        events.append(e)
+
+    for t, cyc, hart, typ, arg, pc in records:
+        args = {"cycle": cyc}
+        where = syms.lookup(pc)
+        if where:
+            args["pc"] = where
+        if typ == TR_TRAP_ENTER:
+            ev("B", trap_name(arg), t, hart, cat="trap", args=args)
+        elif typ == TR_TRAP_EXIT:
+            ev("E", trap_name(arg), t, hart, cat="trap")
+        elif typ == TR_PLIC_CLAIM and arg == 0:
+            ev("i", "irq claim, none pending", t, hart, cat="irq", args=args)
+        elif typ == TR_PLIC_CLAIM:
+            claims[hart, arg] = (t, args)
+        elif typ == TR_PLIC_COMPLETE:
+            claimer = pc
+            claim = claims.pop((claimer, arg), None)
+            if claim is None:
+                # claimed before the ring's oldest record.
+                ev("i", "irq %d complete" % arg, t, hart, cat="irq", args=args)
+                continue
+            args = claim[1]
+            if hart != claimer:
+                args["completed_on"] = "hart %d" % hart
+            ev("X", "irq %d %s" % (arg, IRQS.get(arg, "")), claim[0], claimer,
+               cat="irq", dur=(t - claim[0]) * 1e6 / hz, args=args)
+        elif typ in (TR_UART_RX, TR_UART_TX):
+            args["byte"] = repr(chr(arg & 0xff))
+            ev("i", "uart rx" if typ == TR_UART_RX else "uart tx", t, hart,
+               cat="uart", args=args)
+        elif typ in (TR_PORT_READ, TR_PORT_WRITE):
+            args.update(port=arg >> 16, bytes=arg & 0xffff)
+            ev("i", "port read" if typ == TR_PORT_READ else "port write",
+               t, hart, cat="port", args=args)
+        elif typ == TR_DISK_SUBMIT:
+            args["cmd_bytes"] = arg
+            ev("i", "disk submit", t, hart, cat="disk", args=args)
+        elif typ == TR_DISK_COMPLETE:
+            ev("i", "disk complete", t, hart, cat="disk", args=args)
+        elif typ == TR_SWITCH:
+            args["pid"] = arg
+            ev("i", "switch to %s" % ("scheduler" if arg == 0 else "pid %d" % arg),
+               t, hart, cat="sched", args=args)
+        else:
+            ev("i", "event %d" % typ, t, hart, args=args)
+
+    # claims the dump ended before completing.
+    for (hart, irq), (t, args) in sorted(claims.items(), key=lambda c: c[1][0]):
+        ev("i", "irq %d claim" % irq, t, hart, cat="irq", args=args)
+
+    harts = sorted({r[2] for r in records})
+    for h in harts:
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": h,
+                       "args": {"name": "hart %d" % h}})
+    return events
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description="Convert a HAWX trace dump to Chrome/Perfetto JSON.")
+    ap.add_argument("log", nargs="?", help="console log (default: stdin)")
+    ap.add_argument("-s", "--sym", default="kernel/kernel.sym",
+                    help="kernel symbol file (default: kernel/kernel.sym)")
+    opts = ap.parse_args()
+
+    syms = ksym.load(opts.sym, lambda m: print("warning: " + m, file=sys.stderr))
+
+    src = open(opts.log, errors="replace") if opts.log else sys.stdin
+    dumps = list(read_dump(src))
+    if not dumps:
+        sys.exit("no TRACE-BEGIN/TRACE-END block found")
+
+    # the last dump in the log is the interesting one.
+    hz, records = dumps[-1]
+    json.dump({"traceEvents": convert(hz, records, syms),
+               "displayTimeUnit": "ns"}, sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()